@@ -0,0 +1,316 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#include "BarnesHut.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "SpatialSort.hpp"
+#include "constants.hpp"
+using namespace sycl;
+
+// cells with more bodies are built in a separate OpenMP task
+const int task_threshold = 4096;
+
+// flops of a particle-particle and of a particle-node interaction
+const double flops_pp = 29.;
+const double flops_pc = 53.;
+
+struct BarnesHut::Cell {
+  int first, count;      // range of sorted bodies
+  int level;             // depth in the tree, 0 for the root
+  double center[3];      // geometric center of the cube
+  double half;           // half of the side of the cube
+  double mass, com[3];   // total mass and center of mass
+  double q[6];           // xx, xy, xz, yy, yz, zz
+  int size;              // number of nodes in the subtree
+  std::vector<std::unique_ptr<Cell>> child;
+};
+
+BarnesHut::BarnesHut() : _theta(0.5), _leafsize(16) {}
+
+BarnesHut::~BarnesHut() {}
+
+void BarnesHut::build(const real_type* x, const real_type* y,
+                      const real_type* z, const real_type* m, int n) {
+  // bounding cube of all the particles
+  compute_type xmin = x[0], xmax = x[0], ymin = y[0], ymax = y[0];
+  compute_type zmin = z[0], zmax = z[0];
+#pragma omp parallel for reduction(min : xmin, ymin, zmin) \
+    reduction(max : xmax, ymax, zmax)
+  for (int i = 0; i < n; ++i) {
+    xmin = std::min(xmin, compute_type(x[i]));
+    xmax = std::max(xmax, compute_type(x[i]));
+    ymin = std::min(ymin, compute_type(y[i]));
+    ymax = std::max(ymax, compute_type(y[i]));
+    zmin = std::min(zmin, compute_type(z[i]));
+    zmax = std::max(zmax, compute_type(z[i]));
+  }
+  double ext = std::max({xmax - xmin, ymax - ymin, zmax - zmin});
+  ext = ext > 0 ? ext * 1.001 : 1.;
+  const double scale = double(1 << morton_bits) / ext;
+  const uint32_t maxcell = (1u << morton_bits) - 1;
+
+  _keys.resize(n);
+  _perm.resize(n);
+#pragma omp parallel for
+  for (int i = 0; i < n; ++i) {
+    uint32_t ix = std::min(maxcell, uint32_t((x[i] - xmin) * scale));
+    uint32_t iy = std::min(maxcell, uint32_t((y[i] - ymin) * scale));
+    uint32_t iz = std::min(maxcell, uint32_t((z[i] - zmin) * scale));
+    _keys[i] = morton_key(ix, iy, iz);
+    _perm[i] = i;
+  }
+  radix_sort(_keys, _perm);
+
+  _bodies.resize(n);
+#pragma omp parallel for
+  for (int k = 0; k < n; ++k) {
+    const int i = _perm[k];
+    _bodies[k] = {x[i], y[i], z[i], m[i]};
+  }
+
+  Cell root;
+  root.first = 0;
+  root.count = n;
+  root.level = 0;
+  root.center[0] = xmin + 0.5 * ext;
+  root.center[1] = ymin + 0.5 * ext;
+  root.center[2] = zmin + 0.5 * ext;
+  root.half = 0.5 * ext;
+#pragma omp parallel
+#pragma omp single
+  build_cell(&root);
+
+  _nodes.resize(root.size);
+#pragma omp parallel
+#pragma omp single
+  flatten(&root, 0);
+}
+
+void BarnesHut::build_cell(Cell* c) {
+  if (c->count <= _leafsize || c->level == morton_bits) {
+    c->size = 1;
+    moments(c);
+    return;
+  }
+  // the bodies of a cell share the key prefix, so the octants of the next
+  // level are consecutive ranges of the sorted keys
+  const int shift = 3 * (morton_bits - 1 - c->level);
+  const uint64_t* keys = _keys.data();
+  int begin = c->first;
+  const int end = c->first + c->count;
+  for (int oct = 0; oct < 8 && begin < end; ++oct) {
+    const uint64_t* e =
+        std::partition_point(keys + begin, keys + end, [=](uint64_t k) {
+          return int((k >> shift) & 7) <= oct;
+        });
+    const int stop = int(e - keys);
+    if (stop == begin) continue;
+    std::unique_ptr<Cell> ch(new Cell);
+    ch->first = begin;
+    ch->count = stop - begin;
+    ch->level = c->level + 1;
+    ch->half = 0.5 * c->half;
+    for (int d = 0; d < 3; ++d)
+      ch->center[d] = c->center[d] + ((oct >> d) & 1 ? ch->half : -ch->half);
+    c->child.push_back(std::move(ch));
+    begin = stop;
+  }
+  for (auto& ch : c->child) {
+    Cell* p = ch.get();
+#pragma omp task if (p->count > task_threshold)
+    build_cell(p);
+  }
+#pragma omp taskwait
+  c->size = 1;
+  for (auto& ch : c->child) c->size += ch->size;
+  moments(c);
+}
+
+// Monopole and quadrupole moments about the center of mass: directly from the
+// bodies for a leaf, with the parallel axis theorem from the children otherwise
+void BarnesHut::moments(Cell* c) {
+  double mass = 0., com[3] = {0., 0., 0.};
+  if (c->child.empty()) {
+    for (int k = c->first; k < c->first + c->count; ++k) {
+      const BHBody& b = _bodies[k];
+      mass += b.mass;
+      com[0] += b.mass * b.x;
+      com[1] += b.mass * b.y;
+      com[2] += b.mass * b.z;
+    }
+  } else {
+    for (auto& ch : c->child) {
+      mass += ch->mass;
+      for (int d = 0; d < 3; ++d) com[d] += ch->mass * ch->com[d];
+    }
+  }
+  for (int d = 0; d < 3; ++d)
+    com[d] = mass > 0. ? com[d] / mass : c->center[d];
+  c->mass = mass;
+  for (int d = 0; d < 3; ++d) c->com[d] = com[d];
+
+  double q[6] = {0., 0., 0., 0., 0., 0.};
+  auto add = [&](double w, double sx, double sy, double sz) {
+    const double s2 = sx * sx + sy * sy + sz * sz;
+    q[0] += w * (3. * sx * sx - s2);
+    q[1] += w * 3. * sx * sy;
+    q[2] += w * 3. * sx * sz;
+    q[3] += w * (3. * sy * sy - s2);
+    q[4] += w * 3. * sy * sz;
+    q[5] += w * (3. * sz * sz - s2);
+  };
+  if (c->child.empty()) {
+    for (int k = c->first; k < c->first + c->count; ++k) {
+      const BHBody& b = _bodies[k];
+      add(b.mass, b.x - com[0], b.y - com[1], b.z - com[2]);
+    }
+  } else {
+    for (auto& ch : c->child) {
+      for (int l = 0; l < 6; ++l) q[l] += ch->q[l];
+      add(ch->mass, ch->com[0] - com[0], ch->com[1] - com[1],
+          ch->com[2] - com[2]);
+    }
+  }
+  for (int l = 0; l < 6; ++l) c->q[l] = q[l];
+}
+
+void BarnesHut::flatten(const Cell* c, int index) {
+  BHNode& node = _nodes[index];
+  node.x = c->com[0];
+  node.y = c->com[1];
+  node.z = c->com[2];
+  node.mass = c->mass;
+  node.qxx = c->q[0];
+  node.qxy = c->q[1];
+  node.qxz = c->q[2];
+  node.qyy = c->q[3];
+  node.qyz = c->q[4];
+  node.qzz = c->q[5];
+  // open the node if the particle is closer than size / theta, measured from
+  // the center of mass, plus the offset of the center of mass from the center
+  if (_theta > 0) {
+    double dx = c->com[0] - c->center[0];
+    double dy = c->com[1] - c->center[1];
+    double dz = c->com[2] - c->center[2];
+    double r = 2. * c->half / _theta + std::sqrt(dx * dx + dy * dy + dz * dz);
+    node.open2 = std::min(r * r, double(FLT_MAX));
+  } else {
+    node.open2 = FLT_MAX;
+  }
+  node.next = index + c->size;
+  node.first = c->first;
+  node.count = c->child.empty() ? c->count : 0;
+
+  int ci = index + 1;
+  for (auto& ch : c->child) {
+    const Cell* p = ch.get();
+#pragma omp task if (p->count > task_threshold)
+    flatten(p, ci);
+    ci += p->size;
+  }
+#pragma omp taskwait
+}
+
+double BarnesHut::accelerations(queue& q, buffer<real_type>& axbuf,
+                                buffer<real_type>& aybuf,
+                                buffer<real_type>& azbuf) {
+  const int n = (int)_bodies.size();
+  const int nnodes = (int)_nodes.size();
+  std::vector<int> counts(2 * n);
+  {
+    buffer nbuf(_nodes.data(), range<1>(nnodes));
+    buffer bbuf(_bodies.data(), range<1>(n));
+    buffer pbuf(_perm.data(), range<1>(n));
+    buffer cbuf(counts.data(), range<1>(2 * n));
+    q.submit([&](handler& h) {
+       auto nd = nbuf.get_access<access::mode::read>(h);
+       auto b = bbuf.get_access<access::mode::read>(h);
+       auto perm = pbuf.get_access<access::mode::read>(h);
+       auto ax = axbuf.get_access<access::mode::read_write>(h);
+       auto ay = aybuf.get_access<access::mode::read_write>(h);
+       auto az = azbuf.get_access<access::mode::read_write>(h);
+       auto cnt = cbuf.get_access<access::mode::discard_write>(h);
+       // consecutive work-items take neighbouring bodies along the Morton
+       // curve, so they walk nearly the same part of the tree
+       h.parallel_for(range<1>(n), [=](id<1> k) {
+         const compute_type xi = b[k].x;
+         const compute_type yi = b[k].y;
+         const compute_type zi = b[k].z;
+         accum_type acc0 = 0, acc1 = 0, acc2 = 0;
+         int npp = 0, npc = 0;
+         int node = 0;
+         while (node < nnodes) {
+           const compute_type dx = nd[node].x - xi;
+           const compute_type dy = nd[node].y - yi;
+           const compute_type dz = nd[node].z - zi;
+           compute_type r2 = dx * dx + dy * dy + dz * dz;
+           if (r2 > nd[node].open2) {
+             // far enough: monopole and quadrupole of the whole subtree
+             r2 += softeningSquared;
+             const compute_type rinv = 1.0f / sycl::sqrt(r2);
+             const compute_type rinv2 = rinv * rinv;
+             const compute_type qdx = nd[node].qxx * dx + nd[node].qxy * dy +
+                                   nd[node].qxz * dz;
+             const compute_type qdy = nd[node].qxy * dx + nd[node].qyy * dy +
+                                   nd[node].qyz * dz;
+             const compute_type qdz = nd[node].qxz * dx + nd[node].qyz * dy +
+                                   nd[node].qzz * dz;
+             const compute_type dqd = dx * qdx + dy * qdy + dz * qdz;
+             const compute_type gq = G * rinv2 * rinv2 * rinv;
+             const compute_type f =
+                 G * nd[node].mass * rinv * rinv2 + 2.5f * gq * dqd * rinv2;
+             acc0 += f * dx - gq * qdx;
+             acc1 += f * dy - gq * qdy;
+             acc2 += f * dz - gq * qdz;
+             npc++;
+             node = nd[node].next;
+           } else if (nd[node].count > 0) {
+             // leaf that is too close: direct sum over its bodies
+             const int first = nd[node].first;
+             const int last = first + nd[node].count;
+             for (int j = first; j < last; j++) {
+               const compute_type ex = b[j].x - xi;
+               const compute_type ey = b[j].y - yi;
+               const compute_type ez = b[j].z - zi;
+               const compute_type distanceSqr =
+                   ex * ex + ey * ey + ez * ez + softeningSquared;
+               const compute_type distanceInv = 1.0f / sycl::sqrt(distanceSqr);
+               const compute_type s =
+                   G * b[j].mass * distanceInv * distanceInv * distanceInv;
+               acc0 += ex * s;
+               acc1 += ey * s;
+               acc2 += ez * s;
+             }
+             npp += last - first;
+             node = nd[node].next;
+           } else {
+             // open the node: its first child follows it
+             node++;
+           }
+         }
+         const int i = perm[k];
+         ax[i] += real_type(acc0);
+         ay[i] += real_type(acc1);
+         az[i] += real_type(acc2);
+         cnt[k] = npp;
+         cnt[n + k] = npc;
+       });
+     })
+        .wait_and_throw();
+  }
+
+  double npp = 0., npc = 0.;
+#pragma omp parallel for reduction(+ : npp, npc)
+  for (int k = 0; k < n; ++k) {
+    npp += counts[k];
+    npc += counts[n + k];
+  }
+  return flops_pp * npp + flops_pc * npc;
+}
@@ -0,0 +1,77 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#ifndef _BARNESHUT_HPP
+#define _BARNESHUT_HPP
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <CL/sycl.hpp>
+#include "type.hpp"
+
+// Node of the flattened octree. The nodes are stored in depth-first order, so
+// the first child of an internal node is the node that follows it, and "next"
+// is the first node after the whole subtree.
+struct BHNode {
+  compute_type x, y, z, mass;                 // center of mass and total mass
+  compute_type qxx, qxy, qxz, qyy, qyz, qzz;  // traceless quadrupole moment
+  compute_type open2;  // squared distance below which the node is opened
+  int next;         // node after this subtree
+  int first;        // first body of a leaf
+  int count;        // bodies of a leaf, 0 for an internal node
+};
+
+// particle sorted along the Morton curve, as seen by the tree walk
+struct BHBody {
+  compute_type x, y, z, mass;
+};
+
+// Barnes-Hut solver: the octree and its monopole and quadrupole moments are
+// built in parallel on the host, the tree is walked on the SYCL device.
+class BarnesHut {
+ public:
+  BarnesHut();
+  ~BarnesHut();
+
+  // opening angle: a node is accepted if size / distance < theta
+  void set_theta(compute_type theta) { _theta = theta; }
+  compute_type get_theta() const { return _theta; }
+
+  // maximum number of particles in a leaf
+  void set_leaf_size(int n) { _leafsize = n; }
+  int get_leaf_size() const { return _leafsize; }
+
+  // Builds the octree of the given particles
+  void build(const real_type *x, const real_type *y, const real_type *z,
+             const real_type *m, int n);
+
+  // Walks the tree for every particle and adds the resulting accelerations
+  // to ax, ay and az. Returns the number of flops spent.
+  double accelerations(sycl::queue &q, sycl::buffer<real_type> &ax,
+                       sycl::buffer<real_type> &ay,
+                       sycl::buffer<real_type> &az);
+
+  int get_number_of_nodes() const { return (int)_nodes.size(); }
+
+ private:
+  struct Cell;
+
+  compute_type _theta;
+  int _leafsize;
+
+  std::vector<uint64_t> _keys;  // sorted Morton keys
+  std::vector<int> _perm;       // original index of each sorted body
+  std::vector<BHBody> _bodies;
+  std::vector<BHNode> _nodes;
+
+  void build_cell(Cell *c);
+  void moments(Cell *c);
+  void flatten(const Cell *c, int index);
+};
+
+#endif
@@ -0,0 +1,151 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#include "CellList.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "SpatialSort.hpp"
+#include "constants.hpp"
+using namespace sycl;
+
+// flops of a pair inside the cutoff radius and of the distance test of a pair
+const double flops_pair_cut = 29.;
+const double flops_test = 8.;
+
+CellList::CellList() : _cutoff(0.1) { _dim[0] = _dim[1] = _dim[2] = 1; }
+
+void CellList::build(const real_type* x, const real_type* y,
+                     const real_type* z, const real_type* m, int n) {
+  // bounding box of all the particles
+  compute_type xmin = x[0], xmax = x[0], ymin = y[0], ymax = y[0];
+  compute_type zmin = z[0], zmax = z[0];
+#pragma omp parallel for reduction(min : xmin, ymin, zmin) \
+    reduction(max : xmax, ymax, zmax)
+  for (int i = 0; i < n; ++i) {
+    xmin = std::min(xmin, compute_type(x[i]));
+    xmax = std::max(xmax, compute_type(x[i]));
+    ymin = std::min(ymin, compute_type(y[i]));
+    ymax = std::max(ymax, compute_type(y[i]));
+    zmin = std::min(zmin, compute_type(z[i]));
+    zmax = std::max(zmax, compute_type(z[i]));
+  }
+  const double lo[3] = {xmin, ymin, zmin};
+  const double ext[3] = {(xmax - xmin) * 1.001, (ymax - ymin) * 1.001,
+                         (zmax - zmin) * 1.001};
+
+  // cells no narrower than the cutoff, and not more cells than particles
+  double ncell = 1.;
+  for (int d = 0; d < 3; ++d) {
+    _dim[d] = std::max(1, int(std::min(ext[d] / _cutoff, 1e6)));
+    ncell *= _dim[d];
+  }
+  if (ncell > n) {
+    const double f = std::cbrt(double(n) / ncell);
+    for (int d = 0; d < 3; ++d) _dim[d] = std::max(1, int(_dim[d] * f));
+  }
+  double scale[3];
+  for (int d = 0; d < 3; ++d) scale[d] = ext[d] > 0 ? _dim[d] / ext[d] : 0.;
+  const int nx = _dim[0], ny = _dim[1], nz = _dim[2];
+
+  _cell.resize(n);
+#pragma omp parallel for
+  for (int i = 0; i < n; ++i) {
+    const int ix = std::min(nx - 1, int((x[i] - lo[0]) * scale[0]));
+    const int iy = std::min(ny - 1, int((y[i] - lo[1]) * scale[1]));
+    const int iz = std::min(nz - 1, int((z[i] - lo[2]) * scale[2]));
+    _cell[i] = (ix * ny + iy) * nz + iz;
+  }
+  counting_sort(_cell, nx * ny * nz, _perm, _start);
+
+  _bodies.resize(n);
+  std::vector<int> cells(n);
+#pragma omp parallel for
+  for (int k = 0; k < n; ++k) {
+    const int i = _perm[k];
+    _bodies[k] = {x[i], y[i], z[i], m[i]};
+    cells[k] = _cell[i];
+  }
+  _cell.swap(cells);
+}
+
+double CellList::accelerations(queue& q, buffer<real_type>& axbuf,
+                               buffer<real_type>& aybuf,
+                               buffer<real_type>& azbuf) {
+  const int n = (int)_bodies.size();
+  const int nx = _dim[0], ny = _dim[1], nz = _dim[2];
+  const compute_type rc2 = _cutoff * _cutoff;
+  std::vector<int> counts(2 * n);
+  {
+    buffer bbuf(_bodies.data(), range<1>(n));
+    buffer cbuf(_cell.data(), range<1>(n));
+    buffer sbuf(_start.data(), range<1>(_start.size()));
+    buffer pbuf(_perm.data(), range<1>(n));
+    buffer nbuf(counts.data(), range<1>(2 * n));
+    q.submit([&](handler& h) {
+       auto b = bbuf.get_access<access::mode::read>(h);
+       auto cell = cbuf.get_access<access::mode::read>(h);
+       auto start = sbuf.get_access<access::mode::read>(h);
+       auto perm = pbuf.get_access<access::mode::read>(h);
+       auto ax = axbuf.get_access<access::mode::read_write>(h);
+       auto ay = aybuf.get_access<access::mode::read_write>(h);
+       auto az = azbuf.get_access<access::mode::read_write>(h);
+       auto cnt = nbuf.get_access<access::mode::discard_write>(h);
+       // consecutive work-items take bodies of the same cell, so they read
+       // the same neighbouring cells
+       h.parallel_for(range<1>(n), [=](id<1> k) {
+         const compute_type xi = b[k].x;
+         const compute_type yi = b[k].y;
+         const compute_type zi = b[k].z;
+         const int c = cell[k];
+         const int ix = c / (ny * nz), iy = c / nz % ny, iz = c % nz;
+         accum_type acc0 = 0, acc1 = 0, acc2 = 0;
+         int ntest = 0, npair = 0;
+         for (int jx = sycl::max(ix - 1, 0); jx <= sycl::min(ix + 1, nx - 1);
+              ++jx)
+           for (int jy = sycl::max(iy - 1, 0);
+                jy <= sycl::min(iy + 1, ny - 1); ++jy) {
+             // the cells along z are consecutive in the sorted bodies
+             const int c0 = (jx * ny + jy) * nz;
+             const int first = start[c0 + sycl::max(iz - 1, 0)];
+             const int last = start[c0 + sycl::min(iz + 1, nz - 1) + 1];
+             for (int j = first; j < last; j++) {
+               const compute_type dx = b[j].x - xi;
+               const compute_type dy = b[j].y - yi;
+               const compute_type dz = b[j].z - zi;
+               const compute_type r2 = dx * dx + dy * dy + dz * dz;
+               if (r2 >= rc2) continue;
+               const compute_type distanceInv =
+                   1.0f / sycl::sqrt(r2 + softeningSquared);
+               const compute_type s =
+                   G * b[j].mass * distanceInv * distanceInv * distanceInv;
+               acc0 += dx * s;
+               acc1 += dy * s;
+               acc2 += dz * s;
+               npair++;
+             }
+             ntest += last - first;
+           }
+         const int i = perm[k];
+         ax[i] += real_type(acc0);
+         ay[i] += real_type(acc1);
+         az[i] += real_type(acc2);
+         cnt[k] = ntest;
+         cnt[n + k] = npair;
+       });
+     })
+        .wait_and_throw();
+  }
+
+  double ntest = 0., npair = 0.;
+#pragma omp parallel for reduction(+ : ntest, npair)
+  for (int k = 0; k < n; ++k) {
+    ntest += counts[k];
+    npair += counts[n + k];
+  }
+  return flops_test * ntest + (flops_pair_cut - flops_test) * npair;
+}
@@ -0,0 +1,53 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#ifndef _CELLLIST_HPP
+#define _CELLLIST_HPP
+
+#include <vector>
+
+#include <CL/sycl.hpp>
+#include "type.hpp"
+
+// particle sorted by cell, as seen by the force kernel
+struct CellBody {
+  compute_type x, y, z, mass;
+};
+
+// Cutoff solver: the particles are binned into a uniform grid of cells at
+// least as wide as the cutoff radius with a parallel counting sort on the
+// host, and the SYCL kernel only visits the 27 cells around each particle.
+class CellList {
+ public:
+  CellList();
+
+  // radius beyond which the pairs do not interact
+  void set_cutoff(compute_type rc) { _cutoff = rc; }
+  compute_type get_cutoff() const { return _cutoff; }
+
+  // Bins the given particles into the cells
+  void build(const real_type *x, const real_type *y, const real_type *z,
+             const real_type *m, int n);
+
+  // Adds the accelerations from the particles within the cutoff radius to
+  // ax, ay and az. Returns the number of flops spent.
+  double accelerations(sycl::queue &q, sycl::buffer<real_type> &ax,
+                       sycl::buffer<real_type> &ay,
+                       sycl::buffer<real_type> &az);
+
+  int get_number_of_cells() const { return _dim[0] * _dim[1] * _dim[2]; }
+
+ private:
+  compute_type _cutoff;
+  int _dim[3];  // cells along each axis
+
+  std::vector<int> _cell;   // cell of each particle, then of each sorted one
+  std::vector<int> _perm;   // original index of each sorted body
+  std::vector<int> _start;  // first sorted body of each cell
+  std::vector<CellBody> _bodies;
+};
+
+#endif
@@ -0,0 +1,189 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#include "Checkpoint.hpp"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char checkpoint_magic[8] = {'N', 'B', 'O', 'D', 'Y', 'C', 'K', 'P'};
+
+static_assert(sizeof(CheckpointHeader) == 64,
+              "the checkpoint header must keep its size");
+
+Checkpoint::Checkpoint() : _map(nullptr), _size(0) {
+#ifdef _WIN32
+  _mapping = nullptr;
+#endif
+}
+
+Checkpoint::~Checkpoint() { close(); }
+
+void Checkpoint::write(const std::string &path, const ParticleSoA &p,
+                       int64_t step, double tstep) {
+  CheckpointHeader h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, checkpoint_magic, sizeof(h.magic));
+  h.version = version;
+  h.real_size = sizeof(real_type);
+  h.nfields = ParticleSoA::nfields;
+  h.header_size = sizeof(CheckpointHeader);
+  h.npart = p.npart;
+  h.stride = p.stride;
+  h.step = step;
+  h.tstep = tstep;
+
+  // the arrays of ParticleSoA are contiguous and written as a single block
+  const std::size_t count = std::size_t(ParticleSoA::nfields) * p.stride;
+  const std::string tmp = path + ".tmp";
+  FILE *f = std::fopen(tmp.c_str(), "wb");
+  if (!f) throw std::runtime_error("cannot create checkpoint " + tmp);
+  bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1 &&
+            std::fwrite(p.data, sizeof(real_type), count, f) == count;
+  ok = std::fclose(f) == 0 && ok;
+#ifdef _WIN32
+  // rename does not replace an existing file on Windows
+  if (ok) std::remove(path.c_str());
+#endif
+  if (!ok || std::rename(tmp.c_str(), path.c_str())) {
+    std::remove(tmp.c_str());
+    throw std::runtime_error("cannot write checkpoint " + path);
+  }
+}
+
+int64_t Checkpoint::convert_csv(const std::string &csv,
+                                const std::string &path) {
+  // reads the whole file at once and parses it with strtod
+  FILE *f = std::fopen(csv.c_str(), "rb");
+  if (!f) throw std::runtime_error("cannot open " + csv);
+  std::vector<char> text;
+  char block[1 << 16];
+  std::size_t len;
+  while ((len = std::fread(block, 1, sizeof(block), f)) > 0)
+    text.insert(text.end(), block, block + len);
+  std::fclose(f);
+  text.push_back('\0');
+
+  const int ncols = 7;
+  std::vector<double> values;
+  int line = 0;
+  for (char *p = text.data(); *p;) {
+    char *eol = std::strchr(p, '\n');
+    if (eol) *eol = '\0';
+    ++line;
+    while (*p == ' ' || *p == '\t') ++p;
+    if (*p && *p != '\r' && *p != '#' && !std::isalpha((unsigned char)*p)) {
+      for (int c = 0; c < ncols; ++c) {
+        char *end;
+        values.push_back(std::strtod(p, &end));
+        if (end == p)
+          throw std::runtime_error(csv + ": bad value on line " +
+                                   std::to_string(line));
+        p = end;
+        while (*p == ',' || *p == ' ' || *p == '\t') ++p;
+      }
+    }
+    if (!eol) break;
+    p = eol + 1;
+  }
+
+  ParticleSoA soa;
+  soa.resize(int(values.size() / ncols));
+  real_type *arrays[ncols] = {soa.pos_x, soa.pos_y, soa.pos_z, soa.vel_x,
+                              soa.vel_y, soa.vel_z, soa.mass};
+  for (int i = 0; i < soa.npart; ++i)
+    for (int c = 0; c < ncols; ++c) arrays[c][i] = values[ncols * i + c];
+  write(path, soa, 0, 0.);
+  return soa.npart;
+}
+
+void Checkpoint::open(const std::string &path) {
+  close();
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    throw std::runtime_error("cannot open checkpoint " + path);
+  LARGE_INTEGER size;
+  GetFileSizeEx(file, &size);
+  _size = std::size_t(size.QuadPart);
+  _mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (_mapping) _map = MapViewOfFile(_mapping, FILE_MAP_COPY, 0, 0, 0);
+  if (!_map) {
+    close();
+    throw std::runtime_error("cannot map checkpoint " + path);
+  }
+#else
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("cannot open checkpoint " + path);
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < (off_t)sizeof(CheckpointHeader)) {
+    ::close(fd);
+    throw std::runtime_error("invalid checkpoint " + path);
+  }
+  _size = std::size_t(st.st_size);
+  // private mapping: the simulation updates the arrays in place, the pages
+  // are only copied when they are first written
+  void *map = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) throw std::runtime_error("cannot map checkpoint " + path);
+  _map = map;
+#endif
+
+  const CheckpointHeader &h = header();
+  const char *error = nullptr;
+  if (_size < sizeof(CheckpointHeader) ||
+      std::memcmp(h.magic, checkpoint_magic, sizeof(h.magic)))
+    error = "not a checkpoint";
+  else if (h.version != version)
+    error = "unsupported checkpoint version";
+  else if (h.real_size != sizeof(real_type))
+    error = "checkpoint written with a different precision";
+  else if (h.nfields != ParticleSoA::nfields ||
+           h.header_size % ParticleSoA::alignment || h.npart <= 0 ||
+           h.stride < h.npart ||
+           _size < h.header_size + std::size_t(h.nfields) * h.stride *
+                                       h.real_size)
+    error = "corrupted checkpoint";
+  if (error) {
+    close();
+    throw std::runtime_error(std::string(error) + " " + path);
+  }
+}
+
+void Checkpoint::close() {
+#ifdef _WIN32
+  if (_map) UnmapViewOfFile(_map);
+  if (_mapping) CloseHandle(_mapping);
+  _mapping = nullptr;
+#else
+  if (_map) munmap(_map, _size);
+#endif
+  _map = nullptr;
+  _size = 0;
+}
+
+void Checkpoint::attach(ParticleSoA &p) {
+  const CheckpointHeader &h = header();
+  real_type *data = reinterpret_cast<real_type *>(
+      static_cast<char *>(_map) + h.header_size);
+  p.attach(data, int(h.npart), int(h.stride));
+}
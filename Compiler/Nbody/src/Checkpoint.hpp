@@ -0,0 +1,73 @@
+#ifndef _CHECKPOINT_HPP
+#define _CHECKPOINT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "ParticleSoA.hpp"
+
+// Header of a checkpoint file. It is followed at offset "header_size" by the
+// nfields arrays of ParticleSoA (x, y, z, vx, vy, vz, ax, ay, az, mass), each
+// of "stride" elements, in the native byte order.
+struct CheckpointHeader {
+  char magic[8];         // "NBODYCKP"
+  uint32_t version;      // version of the format
+  uint32_t real_size;    // size of one element, sizeof(real_type)
+  uint32_t nfields;      // number of arrays
+  uint32_t header_size;  // offset of the first array, multiple of 64
+  int64_t npart;         // number of particles
+  int64_t stride;        // distance between two arrays in elements
+  int64_t step;          // number of completed time steps
+  double tstep;          // time step
+  char reserved[8];
+};
+
+// Binary checkpoint of the particles. A checkpoint is written with a single
+// copy of the SoA arrays and restarted by mapping the file into memory, so
+// that the arrays are used in place without reading or converting them.
+class Checkpoint {
+ public:
+  static const uint32_t version = 1;
+
+  Checkpoint();
+  ~Checkpoint();
+
+  Checkpoint(const Checkpoint &) = delete;
+  Checkpoint &operator=(const Checkpoint &) = delete;
+
+  // Writes the particles after "step" time steps of size "tstep". The file is
+  // written under a temporary name and renamed, so an interrupted write
+  // leaves the previous checkpoint intact. Throws std::runtime_error.
+  static void write(const std::string &path, const ParticleSoA &p,
+                    int64_t step, double tstep);
+
+  // Converts initial conditions from a text file with one particle per line,
+  // "x y z vx vy vz m" separated by commas or blanks, into a checkpoint at
+  // step 0. Lines starting with '#' or a letter are skipped. Returns the
+  // number of particles. Throws std::runtime_error.
+  static int64_t convert_csv(const std::string &csv, const std::string &path);
+
+  // Maps a checkpoint copy-on-write and checks its header. Throws
+  // std::runtime_error if the file cannot be used.
+  void open(const std::string &path);
+  void close();
+  bool is_open() const { return _map != nullptr; }
+
+  const CheckpointHeader &header() const {
+    return *static_cast<const CheckpointHeader *>(_map);
+  }
+
+  // Makes "p" use the arrays of the mapped file without copying them. They
+  // stay valid until the checkpoint is closed.
+  void attach(ParticleSoA &p);
+
+ private:
+  void *_map;
+  std::size_t _size;
+#ifdef _WIN32
+  void *_mapping;  // handle of the file mapping object
+#endif
+};
+
+#endif
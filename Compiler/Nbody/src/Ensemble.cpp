@@ -0,0 +1,267 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#include "Ensemble.hpp"
+
+#include <algorithm>
+
+#include "Flops.hpp"
+#include "Interaction.hpp"
+
+using namespace sycl;
+
+// One SYCL buffer for each component of the packed arrays, and the offset
+// and the number of particles of every system
+struct Ensemble::Buffers {
+  Buffers(ParticleSoA& ps, std::vector<int>& offset, std::vector<int>& count)
+      : x(ps.pos_x, range<1>(ps.npart), {property::buffer::use_host_ptr()}),
+        y(ps.pos_y, range<1>(ps.npart), {property::buffer::use_host_ptr()}),
+        z(ps.pos_z, range<1>(ps.npart), {property::buffer::use_host_ptr()}),
+        vx(ps.vel_x, range<1>(ps.npart), {property::buffer::use_host_ptr()}),
+        vy(ps.vel_y, range<1>(ps.npart), {property::buffer::use_host_ptr()}),
+        vz(ps.vel_z, range<1>(ps.npart), {property::buffer::use_host_ptr()}),
+        ax(ps.acc_x, range<1>(ps.npart), {property::buffer::use_host_ptr()}),
+        ay(ps.acc_y, range<1>(ps.npart), {property::buffer::use_host_ptr()}),
+        az(ps.acc_z, range<1>(ps.npart), {property::buffer::use_host_ptr()}),
+        m(ps.mass, range<1>(ps.npart), {property::buffer::use_host_ptr()}),
+        offset(offset.data(), range<1>(offset.size())),
+        count(count.data(), range<1>(count.size())),
+        ksum(range<1>(count.size())) {}
+  buffer<real_type> x, y, z;
+  buffer<real_type> vx, vy, vz;
+  buffer<real_type> ax, ay, az;
+  buffer<real_type> m;
+  buffer<int> offset, count;
+  buffer<accum_type> ksum;  // kinetic energy of every system
+};
+
+Ensemble::Ensemble()
+    : _maxcount(0), _pairs(0.), _wgsize(128), _evaluations(0.), _bytes(0.) {}
+
+Ensemble::~Ensemble() = default;
+
+void Ensemble::add(const Particle* p, int n) {
+  _offset.push_back(int(_particles.size()));
+  _count.push_back(n);
+  _particles.insert(_particles.end(), p, p + n);
+  _maxcount = std::max(_maxcount, n);
+  _pairs += double(n) * double(n);
+}
+
+void Ensemble::start() {
+  _soa.resize(get_particles());
+  _soa.load(_particles.data());
+  _b.reset(new Buffers(_soa, _offset, _count));
+}
+
+// A row of work-groups per system, as many as its largest system needs. The
+// work-groups are no larger than the systems.
+range<2> Ensemble::local_range() const {
+  return range<2>(1, std::max(1, std::min(_wgsize, _maxcount)));
+}
+
+range<2> Ensemble::global_range() const {
+  const int wg = int(local_range()[1]);
+  return range<2>(get_systems(), ((_maxcount + wg - 1) / wg) * wg);
+}
+
+event Ensemble::force(queue& q) {
+  const int wg = int(local_range()[1]);
+  return q.submit([&](handler& h) {
+    auto x = _b->x.get_access<access::mode::read>(h);
+    auto y = _b->y.get_access<access::mode::read>(h);
+    auto z = _b->z.get_access<access::mode::read>(h);
+    auto m = _b->m.get_access<access::mode::read>(h);
+    auto ax = _b->ax.get_access<access::mode::read_write>(h);
+    auto ay = _b->ay.get_access<access::mode::read_write>(h);
+    auto az = _b->az.get_access<access::mode::read_write>(h);
+    auto offset = _b->offset.get_access<access::mode::read>(h);
+    auto count = _b->count.get_access<access::mode::read>(h);
+    local_accessor<real_type, 1> tx(range<1>(wg), h);
+    local_accessor<real_type, 1> ty(range<1>(wg), h);
+    local_accessor<real_type, 1> tz(range<1>(wg), h);
+    local_accessor<real_type, 1> tm(range<1>(wg), h);
+    h.parallel_for(
+        nd_range<2>(global_range(), local_range()), [=](nd_item<2> it) {
+          const int k = it.get_global_id(0);
+          const int first = offset[k];
+          const int n = count[k];
+          // the work-groups past a smaller system have nothing to do, the
+          // whole group leaves before the barriers
+          if (int(it.get_group(1)) * wg >= n) return;
+          const int i = it.get_global_id(1);
+          // the padding work-items of the last group only help loading
+          const bool active = i < n;
+          const compute_type xi = active ? compute_type(x[first + i]) : 0;
+          const compute_type yi = active ? compute_type(y[first + i]) : 0;
+          const compute_type zi = active ? compute_type(z[first + i]) : 0;
+          accum_type acc0 = active ? accum_type(ax[first + i]) : 0;
+          accum_type acc1 = active ? accum_type(ay[first + i]) : 0;
+          accum_type acc2 = active ? accum_type(az[first + i]) : 0;
+          tiled_accelerations(it, wg, wg, x, y, z, m, first, n, tx, ty, tz,
+                              tm, xi, yi, zi, acc0, acc1, acc2);
+          if (active) {
+            ax[first + i] = acc0;
+            ay[first + i] = acc1;
+            az[first + i] = acc2;
+          }
+        });
+  });
+}
+
+// Euler step of all the particles, the accelerations are cleared for the next
+// force computation
+event Ensemble::update(queue& q, compute_type dt) {
+  return q.submit([&](handler& h) {
+    auto x = _b->x.get_access<access::mode::read_write>(h);
+    auto y = _b->y.get_access<access::mode::read_write>(h);
+    auto z = _b->z.get_access<access::mode::read_write>(h);
+    auto vx = _b->vx.get_access<access::mode::read_write>(h);
+    auto vy = _b->vy.get_access<access::mode::read_write>(h);
+    auto vz = _b->vz.get_access<access::mode::read_write>(h);
+    auto ax = _b->ax.get_access<access::mode::read_write>(h);
+    auto ay = _b->ay.get_access<access::mode::read_write>(h);
+    auto az = _b->az.get_access<access::mode::read_write>(h);
+    auto offset = _b->offset.get_access<access::mode::read>(h);
+    auto count = _b->count.get_access<access::mode::read>(h);
+    h.parallel_for(
+        nd_range<2>(global_range(), local_range()), [=](nd_item<2> it) {
+          const int k = it.get_global_id(0);
+          if (int(it.get_global_id(1)) >= count[k]) return;
+          const int i = offset[k] + it.get_global_id(1);
+          vx[i] += ax[i] * dt;  // 2flops
+          vy[i] += ay[i] * dt;  // 2flops
+          vz[i] += az[i] * dt;  // 2flops
+
+          x[i] += vx[i] * dt;  // 2flops
+          y[i] += vy[i] * dt;  // 2flops
+          z[i] += vz[i] * dt;  // 2flops
+
+          ax[i] = 0.;
+          ay[i] = 0.;
+          az[i] = 0.;
+        });
+  });
+}
+
+// v += a tau
+event Ensemble::kick(queue& q, compute_type tau) {
+  return q.submit([&](handler& h) {
+    auto vx = _b->vx.get_access<access::mode::read_write>(h);
+    auto vy = _b->vy.get_access<access::mode::read_write>(h);
+    auto vz = _b->vz.get_access<access::mode::read_write>(h);
+    auto ax = _b->ax.get_access<access::mode::read>(h);
+    auto ay = _b->ay.get_access<access::mode::read>(h);
+    auto az = _b->az.get_access<access::mode::read>(h);
+    auto offset = _b->offset.get_access<access::mode::read>(h);
+    auto count = _b->count.get_access<access::mode::read>(h);
+    h.parallel_for(
+        nd_range<2>(global_range(), local_range()), [=](nd_item<2> it) {
+          const int k = it.get_global_id(0);
+          if (int(it.get_global_id(1)) >= count[k]) return;
+          const int i = offset[k] + it.get_global_id(1);
+          vx[i] += ax[i] * tau;  // 2flops
+          vy[i] += ay[i] * tau;  // 2flops
+          vz[i] += az[i] * tau;  // 2flops
+        });
+  });
+}
+
+// x += v tau, the accelerations are cleared for the next force computation
+event Ensemble::drift(queue& q, compute_type tau) {
+  return q.submit([&](handler& h) {
+    auto x = _b->x.get_access<access::mode::read_write>(h);
+    auto y = _b->y.get_access<access::mode::read_write>(h);
+    auto z = _b->z.get_access<access::mode::read_write>(h);
+    auto vx = _b->vx.get_access<access::mode::read>(h);
+    auto vy = _b->vy.get_access<access::mode::read>(h);
+    auto vz = _b->vz.get_access<access::mode::read>(h);
+    auto ax = _b->ax.get_access<access::mode::discard_write>(h);
+    auto ay = _b->ay.get_access<access::mode::discard_write>(h);
+    auto az = _b->az.get_access<access::mode::discard_write>(h);
+    auto offset = _b->offset.get_access<access::mode::read>(h);
+    auto count = _b->count.get_access<access::mode::read>(h);
+    h.parallel_for(
+        nd_range<2>(global_range(), local_range()), [=](nd_item<2> it) {
+          const int k = it.get_global_id(0);
+          if (int(it.get_global_id(1)) >= count[k]) return;
+          const int i = offset[k] + it.get_global_id(1);
+          x[i] += vx[i] * tau;  // 2flops
+          y[i] += vy[i] * tau;  // 2flops
+          z[i] += vz[i] * tau;  // 2flops
+
+          ax[i] = 0.;
+          ay[i] = 0.;
+          az[i] = 0.;
+        });
+  });
+}
+
+template <Integrator I>
+event Ensemble::kdk_step(queue& q, compute_type dt, double& gflops) {
+  using S = KDKScheme<I>;
+  const double n = get_particles();
+  event last = kick(q, S::kick[0] * dt);
+  _updates.push_back(last);
+  for (int k = 0; k < S::stages; ++k) {
+    _updates.push_back(drift(q, S::drift[k] * dt));
+    _forces.push_back(force(q));
+    last = kick(q, S::kick[k + 1] * dt);
+    _updates.push_back(last);
+  }
+  _evaluations = S::stages;
+  _bytes = sizeof(real_type) * n *
+           (S::stages * (words_force + words_drift) +
+            (S::stages + 1) * words_kick);
+  gflops += 1e-9 * (S::stages * (flops_pair * _pairs + flops_drift * n) +
+                    (S::stages + 1) * flops_kick * n);
+  return last;
+}
+
+event Ensemble::step(queue& q, Integrator integrator, compute_type dt,
+                     double& gflops) {
+  _forces.clear();
+  _updates.clear();
+  if (integrator == Integrator::Leapfrog)
+    return kdk_step<Integrator::Leapfrog>(q, dt, gflops);
+  if (integrator == Integrator::Yoshida4)
+    return kdk_step<Integrator::Yoshida4>(q, dt, gflops);
+  const double n = get_particles();
+  _forces.push_back(force(q));
+  event last = update(q, dt);
+  _updates.push_back(last);
+  _evaluations = 1.;
+  _bytes = sizeof(real_type) * n * (words_force + words_euler);
+  gflops += 1e-9 * (flops_pair * _pairs + flops_euler * n);
+  return last;
+}
+
+// One work-item per system sums m v^2 over its particles
+std::vector<accum_type> Ensemble::kinetic_energies(queue& q) {
+  q.submit([&](handler& h) {
+    auto vx = _b->vx.get_access<access::mode::read>(h);
+    auto vy = _b->vy.get_access<access::mode::read>(h);
+    auto vz = _b->vz.get_access<access::mode::read>(h);
+    auto m = _b->m.get_access<access::mode::read>(h);
+    auto offset = _b->offset.get_access<access::mode::read>(h);
+    auto count = _b->count.get_access<access::mode::read>(h);
+    auto ksum = _b->ksum.get_access<access::mode::discard_write>(h);
+    h.parallel_for(range<1>(get_systems()), [=](id<1> k) {
+      accum_type e = 0.;
+      for (int i = offset[k]; i < offset[k] + count[k]; ++i) {
+        const compute_type v2 = compute_type(vx[i]) * vx[i] +
+                                compute_type(vy[i]) * vy[i] +
+                                compute_type(vz[i]) * vz[i];
+        e += accum_type(m[i]) * v2;
+      }
+      ksum[k] = 0.5 * e;
+    });
+  });
+  auto ksum = _b->ksum.get_access<access::mode::read>();
+  std::vector<accum_type> energies(get_systems());
+  for (int k = 0; k < get_systems(); ++k) energies[k] = ksum[k];
+  return energies;
+}
@@ -0,0 +1,87 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#ifndef _ENSEMBLE_HPP
+#define _ENSEMBLE_HPP
+
+#include <memory>
+#include <vector>
+
+#include <CL/sycl.hpp>
+#include "Integrator.hpp"
+#include "Particle.hpp"
+#include "ParticleSoA.hpp"
+
+// Many independent small systems advanced together. The particles of all the
+// systems are packed into one set of SoA arrays, system k owning "count[k]"
+// particles from "offset[k]", and every kernel of a step is a single 2D
+// nd_range over (system, particle): one row of work-groups per system, so
+// the systems fill the device even when each of them is far too small to.
+// The force kernel stages the j-particles of its system in local memory one
+// work-group at a time, with the body of the tiled kernel of the direct
+// solver (Interaction.hpp).
+class Ensemble {
+ public:
+  Ensemble();
+  ~Ensemble();
+
+  // appends a system of n particles, before start
+  void add(const Particle *p, int n);
+  int get_systems() const { return int(_count.size()); }
+  int get_particles() const { return int(_particles.size()); }
+  // pairs of particles of all the systems, the interactions of a force pass
+  double get_pairs() const { return _pairs; }
+
+  // work-items per work-group along the particles of a system
+  void set_work_group_size(int wg) { _wgsize = wg; }
+
+  // packs the systems into the SoA arrays and creates their buffers
+  void start();
+
+  // adds the accelerations of all the particles of each system
+  sycl::event force(sycl::queue &q);
+
+  // Advances all the systems by one step of the Euler or a kick-drift-kick
+  // scheme and adds the flops to "gflops". The kernels of the step are kept
+  // for the profile.
+  sycl::event step(sycl::queue &q, Integrator integrator, compute_type dt,
+                   double &gflops);
+  const std::vector<sycl::event> &get_force_events() const { return _forces; }
+  const std::vector<sycl::event> &get_update_events() const {
+    return _updates;
+  }
+  // force evaluations and bytes moved by the kernels of the last step
+  double get_evaluations() const { return _evaluations; }
+  double get_bytes() const { return _bytes; }
+
+  // kinetic energy of every system
+  std::vector<accum_type> kinetic_energies(sycl::queue &q);
+
+ private:
+  struct Buffers;
+
+  std::vector<Particle> _particles;  // systems appended by add
+  std::vector<int> _offset, _count;
+  int _maxcount;
+  double _pairs;
+  int _wgsize;
+
+  ParticleSoA _soa;
+  std::unique_ptr<Buffers> _b;
+
+  std::vector<sycl::event> _forces, _updates;
+  double _evaluations, _bytes;
+
+  sycl::range<2> global_range() const;
+  sycl::range<2> local_range() const;
+  sycl::event update(sycl::queue &q, compute_type dt);
+  sycl::event kick(sycl::queue &q, compute_type tau);
+  sycl::event drift(sycl::queue &q, compute_type tau);
+  template <Integrator I>
+  sycl::event kdk_step(sycl::queue &q, compute_type dt, double &gflops);
+};
+
+#endif
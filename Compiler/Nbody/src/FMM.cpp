@@ -0,0 +1,460 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#include "FMM.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "SpatialSort.hpp"
+#include "constants.hpp"
+
+// deepest level of the octree
+const int max_depth = 10;
+
+// Multi-indices n = (nx, ny, nz) are numbered by increasing order |n|, so that
+// every recurrence below only reads coefficients that are already computed.
+//
+// With d = x_j - c and M_n = sum_j m_j d^n / n!, the potential of the
+// particles of a cell centered in c is psi(x) = sum_n (-1)^|n| M_n D_n(x - c),
+// where D_n are the derivatives of the (softened) 1/r kernel. Around the
+// center z of a far cell psi(z + y) = sum_l L_l y^l / l! with
+// L_l = sum_n (-1)^|n| M_n D_(n+l)(z - c), and the acceleration is G grad psi.
+
+FMM::FMM() : _leafsize(64), _depth(0) { set_order(4); }
+
+void FMM::set_order(int p) {
+  _order = std::max(1, p);
+  p = _order;
+  _lookup.assign((p + 1) * (p + 1) * (p + 1), -1);
+  _nx.clear();
+  _ny.clear();
+  _nz.clear();
+  for (int d = 0; d <= p; ++d)
+    for (int a = d; a >= 0; --a)
+      for (int b = d - a; b >= 0; --b) {
+        _lookup[(a * (p + 1) + b) * (p + 1) + (d - a - b)] = (int)_nx.size();
+        _nx.push_back(a);
+        _ny.push_back(b);
+        _nz.push_back(d - a - b);
+      }
+  _ncoef = (int)_nx.size();
+
+  _mono_parent.assign(_ncoef, 0);
+  _mono_dim.assign(_ncoef, 0);
+  _mono_div.assign(_ncoef, 1.);
+  _sign.assign(_ncoef, 1.);
+  for (int i = 1; i < _ncoef; ++i) {
+    int n[3] = {_nx[i], _ny[i], _nz[i]};
+    int k = n[0] ? 0 : (n[1] ? 1 : 2);
+    _mono_dim[i] = k;
+    _mono_div[i] = n[k];
+    n[k]--;
+    _mono_parent[i] = index(n[0], n[1], n[2]);
+    _sign[i] = (_nx[i] + _ny[i] + _nz[i]) % 2 ? -1. : 1.;
+  }
+
+  _m2m_off.assign(1, 0);
+  _m2m_k.clear();
+  _m2m_nk.clear();
+  for (int i = 0; i < _ncoef; ++i) {
+    for (int k = 0; k < _ncoef; ++k) {
+      if (_nx[k] > _nx[i] || _ny[k] > _ny[i] || _nz[k] > _nz[i]) continue;
+      _m2m_k.push_back(k);
+      _m2m_nk.push_back(index(_nx[i] - _nx[k], _ny[i] - _ny[k], _nz[i] - _nz[k]));
+    }
+    _m2m_off.push_back((int)_m2m_k.size());
+  }
+
+  _l2l_off.assign(1, 0);
+  _l2l_l.clear();
+  _l2l_lk.clear();
+  for (int k = 0; k < _ncoef; ++k) {
+    for (int l = 0; l < _ncoef; ++l) {
+      if (_nx[k] > _nx[l] || _ny[k] > _ny[l] || _nz[k] > _nz[l]) continue;
+      _l2l_l.push_back(l);
+      _l2l_lk.push_back(index(_nx[l] - _nx[k], _ny[l] - _ny[k], _nz[l] - _nz[k]));
+    }
+    _l2l_off.push_back((int)_l2l_l.size());
+  }
+
+  _m2l_off.assign(1, 0);
+  _m2l_n.clear();
+  _m2l_nl.clear();
+  for (int l = 0; l < _ncoef; ++l) {
+    for (int n = 0; n < _ncoef; ++n) {
+      int nl = index(_nx[n] + _nx[l], _ny[n] + _ny[l], _nz[n] + _nz[l]);
+      if (nl < 0) continue;
+      _m2l_n.push_back(n);
+      _m2l_nl.push_back(nl);
+    }
+    _m2l_off.push_back((int)_m2l_n.size());
+  }
+
+  for (int k = 0; k < 3; ++k) {
+    _grad[k].assign(_ncoef, -1);
+    for (int l = 0; l < _ncoef; ++l)
+      _grad[k][l] = index(_nx[l] + (k == 0), _ny[l] + (k == 1), _nz[l] + (k == 2));
+  }
+}
+
+int FMM::index(int nx, int ny, int nz) const {
+  if (nx + ny + nz > _order) return -1;
+  return _lookup[(nx * (_order + 1) + ny) * (_order + 1) + nz];
+}
+
+// d^n / n! for all the multi-indices
+void FMM::monomials(double dx, double dy, double dz, double* mono) const {
+  const double d[3] = {dx, dy, dz};
+  mono[0] = 1.;
+  for (int i = 1; i < _ncoef; ++i)
+    mono[i] = mono[_mono_parent[i]] * d[_mono_dim[i]] / _mono_div[i];
+}
+
+// Derivatives D_n of the softened kernel 1/sqrt(r^2 + eps^2). With
+// s = r^2 + eps^2 they satisfy
+// |n| s D_n = -(2|n|-1) sum_k n_k r_k D_(n-e_k) - (|n|-1) sum_k n_k (n_k-1) D_(n-2e_k)
+void FMM::derivatives(double rx, double ry, double rz, double* D) const {
+  const double r[3] = {rx, ry, rz};
+  const double s = rx * rx + ry * ry + rz * rz + softeningSquared;
+  const double sinv = 1. / s;
+  D[0] = std::sqrt(sinv);
+  for (int i = 1; i < _ncoef; ++i) {
+    const int n[3] = {_nx[i], _ny[i], _nz[i]};
+    const int order = n[0] + n[1] + n[2];
+    double a = 0., b = 0.;
+    for (int k = 0; k < 3; ++k) {
+      if (n[k] < 1) continue;
+      int m[3] = {n[0], n[1], n[2]};
+      m[k]--;
+      a += n[k] * r[k] * D[index(m[0], m[1], m[2])];
+      if (n[k] < 2) continue;
+      m[k]--;
+      b += n[k] * (n[k] - 1) * D[index(m[0], m[1], m[2])];
+    }
+    D[i] = -((2 * order - 1) * a + (order - 1) * b) * sinv / order;
+  }
+}
+
+void FMM::cell_center(int level, uint64_t key, double* c) const {
+  const double h = _extent / double(1 << level);
+  c[0] = _origin[0] + (compact_bits(key) + 0.5) * h;
+  c[1] = _origin[1] + (compact_bits(key >> 1) + 0.5) * h;
+  c[2] = _origin[2] + (compact_bits(key >> 2) + 0.5) * h;
+}
+
+// index of the cell (ix, iy, iz) of a level, -1 if it is empty
+int FMM::find(int level, int ix, int iy, int iz) const {
+  const int ncell = 1 << level;
+  if (ix < 0 || iy < 0 || iz < 0 || ix >= ncell || iy >= ncell || iz >= ncell)
+    return -1;
+  const std::vector<uint64_t>& keys = _levels[level].key;
+  const uint64_t key = morton_key(ix, iy, iz);
+  auto it = std::lower_bound(keys.begin(), keys.end(), key);
+  return (it != keys.end() && *it == key) ? int(it - keys.begin()) : -1;
+}
+
+void FMM::build_tree(const real_type* x, const real_type* y,
+                     const real_type* z, const real_type* m, int n) {
+  double xmin = x[0], xmax = x[0], ymin = y[0], ymax = y[0];
+  double zmin = z[0], zmax = z[0];
+#pragma omp parallel for reduction(min : xmin, ymin, zmin) \
+    reduction(max : xmax, ymax, zmax)
+  for (int i = 0; i < n; ++i) {
+    xmin = std::min(xmin, double(x[i]));
+    xmax = std::max(xmax, double(x[i]));
+    ymin = std::min(ymin, double(y[i]));
+    ymax = std::max(ymax, double(y[i]));
+    zmin = std::min(zmin, double(z[i]));
+    zmax = std::max(zmax, double(z[i]));
+  }
+  double ext = std::max({xmax - xmin, ymax - ymin, zmax - zmin});
+  _extent = ext > 0 ? ext * 1.001 : 1.;
+  _origin[0] = xmin;
+  _origin[1] = ymin;
+  _origin[2] = zmin;
+  const double scale = double(1 << morton_bits) / _extent;
+  const uint32_t maxcell = (1u << morton_bits) - 1;
+
+  _keys.resize(n);
+  _perm.resize(n);
+#pragma omp parallel for
+  for (int i = 0; i < n; ++i) {
+    uint32_t ix = std::min(maxcell, uint32_t((x[i] - xmin) * scale));
+    uint32_t iy = std::min(maxcell, uint32_t((y[i] - ymin) * scale));
+    uint32_t iz = std::min(maxcell, uint32_t((z[i] - zmin) * scale));
+    _keys[i] = morton_key(ix, iy, iz);
+    _perm[i] = i;
+  }
+  radix_sort(_keys, _perm);
+
+  _bx.resize(n);
+  _by.resize(n);
+  _bz.resize(n);
+  _bm.resize(n);
+#pragma omp parallel for
+  for (int k = 0; k < n; ++k) {
+    const int i = _perm[k];
+    _bx[k] = x[i];
+    _by[k] = y[i];
+    _bz[k] = z[i];
+    _bm[k] = m[i];
+  }
+
+  // about "leafsize" particles per leaf for a uniform distribution
+  _depth = 0;
+  while (_depth < max_depth &&
+         double(n) / double(1ull << (3 * _depth)) > _leafsize)
+    _depth++;
+
+  _levels.assign(_depth + 1, Level());
+  Level& leaf = _levels[_depth];
+  const int shift = 3 * (morton_bits - _depth);
+  for (int k = 0; k < n; ++k) {
+    const uint64_t key = _keys[k] >> shift;
+    if (leaf.key.empty() || leaf.key.back() != key) {
+      if (!leaf.key.empty()) leaf.end.push_back(k);
+      leaf.key.push_back(key);
+      leaf.begin.push_back(k);
+    }
+  }
+  leaf.end.push_back(n);
+
+  for (int l = _depth - 1; l >= 0; --l) {
+    Level& lev = _levels[l];
+    Level& child = _levels[l + 1];
+    const int nchild = (int)child.key.size();
+    child.parent.resize(nchild);
+    for (int c = 0; c < nchild; ++c) {
+      const uint64_t key = child.key[c] >> 3;
+      if (lev.key.empty() || lev.key.back() != key) {
+        if (!lev.key.empty()) lev.end.push_back(c);
+        lev.key.push_back(key);
+        lev.begin.push_back(c);
+      }
+      child.parent[c] = (int)lev.key.size() - 1;
+    }
+    lev.end.push_back(nchild);
+  }
+  _levels[0].parent.assign(1, -1);
+
+  for (auto& lev : _levels) {
+    lev.M.assign(lev.key.size() * _ncoef, 0.);
+    lev.L.assign(lev.key.size() * _ncoef, 0.);
+  }
+}
+
+double FMM::accelerations(const real_type* x, const real_type* y,
+                          const real_type* z, const real_type* m,
+                          real_type* ax, real_type* ay, real_type* az, int n) {
+  build_tree(x, y, z, m, n);
+
+  const int nc = _ncoef;
+  const int depth = _depth;
+  double nm2l = 0., npp = 0.;
+  std::vector<double> accx(n, 0.), accy(n, 0.), accz(n, 0.);
+
+  // cells closer than two levels below the root are all neighbours, so there
+  // is no far field to expand
+  if (depth >= 2) {
+    // P2M
+    Level& leaf = _levels[depth];
+#pragma omp parallel
+    {
+      std::vector<double> mono(nc);
+#pragma omp for schedule(dynamic, 16)
+      for (int c = 0; c < (int)leaf.key.size(); ++c) {
+        double center[3];
+        cell_center(depth, leaf.key[c], center);
+        double* M = &leaf.M[c * nc];
+        for (int k = leaf.begin[c]; k < leaf.end[c]; ++k) {
+          monomials(_bx[k] - center[0], _by[k] - center[1], _bz[k] - center[2],
+                    mono.data());
+          for (int i = 0; i < nc; ++i) M[i] += _bm[k] * mono[i];
+        }
+      }
+    }
+
+    // M2M
+    for (int l = depth - 1; l >= 2; --l) {
+      Level& lev = _levels[l];
+      Level& child = _levels[l + 1];
+#pragma omp parallel
+      {
+        std::vector<double> tm(nc);
+#pragma omp for schedule(dynamic, 16)
+        for (int c = 0; c < (int)lev.key.size(); ++c) {
+          double center[3], cc[3];
+          cell_center(l, lev.key[c], center);
+          double* M = &lev.M[c * nc];
+          for (int ch = lev.begin[c]; ch < lev.end[c]; ++ch) {
+            cell_center(l + 1, child.key[ch], cc);
+            monomials(cc[0] - center[0], cc[1] - center[1], cc[2] - center[2],
+                      tm.data());
+            const double* Mc = &child.M[ch * nc];
+            for (int i = 0; i < nc; ++i) {
+              double sum = 0.;
+              for (int q = _m2m_off[i]; q < _m2m_off[i + 1]; ++q)
+                sum += Mc[_m2m_k[q]] * tm[_m2m_nk[q]];
+              M[i] += sum;
+            }
+          }
+        }
+      }
+    }
+
+    // M2L: the interaction list of a cell are the children of the neighbours
+    // of its parent that are not neighbours of the cell itself
+    for (int l = 2; l <= depth; ++l) {
+      Level& lev = _levels[l];
+      Level& up = _levels[l - 1];
+#pragma omp parallel reduction(+ : nm2l)
+      {
+        std::vector<double> D(nc);
+#pragma omp for schedule(dynamic, 16)
+        for (int c = 0; c < (int)lev.key.size(); ++c) {
+          const int ix = compact_bits(lev.key[c]);
+          const int iy = compact_bits(lev.key[c] >> 1);
+          const int iz = compact_bits(lev.key[c] >> 2);
+          double center[3], sc[3];
+          cell_center(l, lev.key[c], center);
+          double* L = &lev.L[c * nc];
+          for (int dz = -1; dz <= 1; ++dz)
+            for (int dy = -1; dy <= 1; ++dy)
+              for (int dx = -1; dx <= 1; ++dx) {
+                const int p = find(l - 1, ix / 2 + dx, iy / 2 + dy, iz / 2 + dz);
+                if (p < 0) continue;
+                for (int s = up.begin[p]; s < up.end[p]; ++s) {
+                  const int jx = compact_bits(lev.key[s]);
+                  const int jy = compact_bits(lev.key[s] >> 1);
+                  const int jz = compact_bits(lev.key[s] >> 2);
+                  if (std::abs(jx - ix) <= 1 && std::abs(jy - iy) <= 1 &&
+                      std::abs(jz - iz) <= 1)
+                    continue;
+                  cell_center(l, lev.key[s], sc);
+                  derivatives(center[0] - sc[0], center[1] - sc[1],
+                              center[2] - sc[2], D.data());
+                  const double* M = &lev.M[s * nc];
+                  for (int i = 0; i < nc; ++i) {
+                    double sum = 0.;
+                    for (int q = _m2l_off[i]; q < _m2l_off[i + 1]; ++q)
+                      sum += _sign[_m2l_n[q]] * M[_m2l_n[q]] * D[_m2l_nl[q]];
+                    L[i] += sum;
+                  }
+                  nm2l += 1.;
+                }
+              }
+        }
+      }
+    }
+
+    // L2L
+    for (int l = 3; l <= depth; ++l) {
+      Level& lev = _levels[l];
+      Level& up = _levels[l - 1];
+#pragma omp parallel
+      {
+        std::vector<double> tm(nc);
+#pragma omp for schedule(dynamic, 16)
+        for (int c = 0; c < (int)lev.key.size(); ++c) {
+          const int p = lev.parent[c];
+          double center[3], pc[3];
+          cell_center(l, lev.key[c], center);
+          cell_center(l - 1, up.key[p], pc);
+          monomials(center[0] - pc[0], center[1] - pc[1], center[2] - pc[2],
+                    tm.data());
+          const double* Lp = &up.L[p * nc];
+          double* L = &lev.L[c * nc];
+          for (int k = 0; k < nc; ++k) {
+            double sum = 0.;
+            for (int q = _l2l_off[k]; q < _l2l_off[k + 1]; ++q)
+              sum += Lp[_l2l_l[q]] * tm[_l2l_lk[q]];
+            L[k] += sum;
+          }
+        }
+      }
+    }
+
+    // L2P
+#pragma omp parallel
+    {
+      std::vector<double> mono(nc);
+#pragma omp for schedule(dynamic, 16)
+      for (int c = 0; c < (int)leaf.key.size(); ++c) {
+        double center[3];
+        cell_center(depth, leaf.key[c], center);
+        const double* L = &leaf.L[c * nc];
+        for (int k = leaf.begin[c]; k < leaf.end[c]; ++k) {
+          monomials(_bx[k] - center[0], _by[k] - center[1], _bz[k] - center[2],
+                    mono.data());
+          double g[3] = {0., 0., 0.};
+          for (int d = 0; d < 3; ++d)
+            for (int i = 0; i < nc; ++i)
+              if (_grad[d][i] >= 0) g[d] += L[_grad[d][i]] * mono[i];
+          accx[k] += G * g[0];
+          accy[k] += G * g[1];
+          accz[k] += G * g[2];
+        }
+      }
+    }
+  }
+
+  // P2P with the neighbouring leaves, including the leaf itself
+  Level& leaf = _levels[depth];
+#pragma omp parallel for schedule(dynamic, 16) reduction(+ : npp)
+  for (int c = 0; c < (int)leaf.key.size(); ++c) {
+    const int ix = compact_bits(leaf.key[c]);
+    const int iy = compact_bits(leaf.key[c] >> 1);
+    const int iz = compact_bits(leaf.key[c] >> 2);
+    for (int dz = -1; dz <= 1; ++dz)
+      for (int dy = -1; dy <= 1; ++dy)
+        for (int dx = -1; dx <= 1; ++dx) {
+          const int s = find(depth, ix + dx, iy + dy, iz + dz);
+          if (s < 0) continue;
+          for (int k = leaf.begin[c]; k < leaf.end[c]; ++k) {
+            double acc0 = 0., acc1 = 0., acc2 = 0.;
+            for (int j = leaf.begin[s]; j < leaf.end[s]; ++j) {
+              const double ex = _bx[j] - _bx[k];
+              const double ey = _by[j] - _by[k];
+              const double ez = _bz[j] - _bz[k];
+              const double distanceSqr =
+                  ex * ex + ey * ey + ez * ez + softeningSquared;
+              const double distanceInv = 1. / std::sqrt(distanceSqr);
+              const double f =
+                  G * _bm[j] * distanceInv * distanceInv * distanceInv;
+              acc0 += ex * f;
+              acc1 += ey * f;
+              acc2 += ez * f;
+            }
+            accx[k] += acc0;
+            accy[k] += acc1;
+            accz[k] += acc2;
+          }
+          npp += double(leaf.end[c] - leaf.begin[c]) *
+                 double(leaf.end[s] - leaf.begin[s]);
+        }
+  }
+
+#pragma omp parallel for
+  for (int k = 0; k < n; ++k) {
+    const int i = _perm[k];
+    ax[i] += accx[k];
+    ay[i] += accy[k];
+    az[i] += accz[k];
+  }
+
+  // flops: P2P as in the direct sum, M2L from the derivative recurrence and
+  // the coefficient products, P2M and L2P from the monomials
+  double flops = 29. * npp;
+  if (depth >= 2) {
+    double ncells = 0.;
+    for (int l = 2; l <= depth; ++l) ncells += double(_levels[l].key.size());
+    flops += nm2l * (12. * nc + 3. * _m2l_n.size());
+    flops += ncells * 2. * (2. * nc + 2. * _m2m_k.size());
+    flops += double(n) * (4. * nc + 6. * nc);
+  }
+  return flops;
+}
@@ -0,0 +1,87 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#ifndef _FMM_HPP
+#define _FMM_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "type.hpp"
+
+// Fast Multipole Method with Cartesian Taylor expansions of configurable
+// order. The particles are binned into the non-empty cells of an octree of
+// uniform depth (addressed by Morton keys), the expansions are computed with
+// P2M, M2M, M2L, L2L and L2P, and neighbouring leaves interact with P2P.
+// Every pass runs in parallel over the cells of a level with OpenMP.
+class FMM {
+ public:
+  FMM();
+
+  // highest order of the multipole and local expansions
+  void set_order(int p);
+  int get_order() const { return _order; }
+
+  // average number of particles per leaf used to choose the tree depth
+  void set_leaf_size(int n) { _leafsize = n; }
+  int get_leaf_size() const { return _leafsize; }
+
+  // Adds the accelerations of all the particles to ax, ay and az.
+  // Returns the number of flops spent.
+  double accelerations(const real_type *x, const real_type *y,
+                       const real_type *z, const real_type *m, real_type *ax,
+                       real_type *ay, real_type *az, int n);
+
+  int get_depth() const { return _depth; }
+
+ private:
+  // non-empty cells of one level of the octree
+  struct Level {
+    std::vector<uint64_t> key;  // Morton key of the cell, ascending
+    std::vector<int> begin;     // children in the next level, or bodies
+    std::vector<int> end;
+    std::vector<int> parent;    // index of the parent cell
+    std::vector<double> M;      // multipole coefficients, ncoef per cell
+    std::vector<double> L;      // local coefficients, ncoef per cell
+  };
+
+  int _order;
+  int _leafsize;
+  int _depth;
+  int _ncoef;  // number of multi-indices n with |n| <= order
+
+  // multi-index tables
+  std::vector<int> _lookup;          // (nx, ny, nz) -> index, -1 if too high
+  std::vector<int> _nx, _ny, _nz;    // components of each multi-index
+  std::vector<int> _mono_parent;     // n - e_k for the first k with n_k > 0
+  std::vector<int> _mono_dim;        // that k
+  std::vector<double> _mono_div;     // n_k of that k
+  std::vector<double> _sign;         // (-1)^|n|
+  std::vector<int> _m2m_off, _m2m_k, _m2m_nk;  // M'_n += M_k t^(n-k)/(n-k)!
+  std::vector<int> _l2l_off, _l2l_l, _l2l_lk;  // L'_k += L_l t^(l-k)/(l-k)!
+  std::vector<int> _m2l_off, _m2l_n, _m2l_nl;  // L_l += (-1)^|n| M_n D_(n+l)
+  std::vector<int> _grad[3];                   // index of l + e_k, -1 if too high
+
+  double _origin[3];  // lower corner of the root cube
+  double _extent;     // side of the root cube
+  std::vector<Level> _levels;
+
+  // particles sorted along the Morton curve
+  std::vector<uint64_t> _keys;
+  std::vector<int> _perm;
+  std::vector<double> _bx, _by, _bz, _bm;
+
+  int index(int nx, int ny, int nz) const;
+  void monomials(double dx, double dy, double dz, double *mono) const;
+  void derivatives(double rx, double ry, double rz, double *D) const;
+  void cell_center(int level, uint64_t key, double *c) const;
+  int find(int level, int ix, int iy, int iz) const;
+
+  void build_tree(const real_type *x, const real_type *y, const real_type *z,
+                  const real_type *m, int n);
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef _FLOPS_HPP
+#define _FLOPS_HPP
+
+// Work counted for the GFlops and the profile of the direct solver, of the
+// integrators and of the ensemble, which runs the same kernels.
+
+// flops of a particle-particle interaction of the direct sum and of the
+// Hermite force kernel
+const double flops_pair = 11. + 18.;
+const double flops_hermite_pair = 43.;
+// flops of a pair of the symmetric kernel, computed once for both particles,
+// per particle and work-item of the sum of the accumulators, and per particle
+// of adding the sum times G
+const double flops_symmetric_pair = 27.;
+const double flops_symmetric_sum = 3.;
+const double flops_symmetric_scale = 6.;
+// flops of a pair of the specialised kernels, with G folded into the masses
+// and the inverse square root counted as for the direct sum
+const double flops_specialized_pair = 20.;
+// flops per particle of the integration kernels, without the 7 flops of
+// m v^2 when the kinetic energy is reduced
+const double flops_euler = 19.;
+const double flops_kick = 6.;
+const double flops_drift = 6.;
+const double flops_predict = 33.;
+const double flops_correct = 36.;
+const double flops_energy = 7.;
+const double flops_block_correct = 36. + 73.;
+// reals read and written per particle by the kernels, for the bytes moved in
+// the profile; the j-particles of the force kernels are assumed to be cached
+const double words_force = 10.;
+const double words_hermite_force = 13.;
+const double words_euler = 19.;
+const double words_kick = 10.;
+const double words_drift = 9.;
+const double words_predict = 30.;
+const double words_correct = 36.;
+
+#endif
@@ -10,9 +10,21 @@
 // MIT License
 // =============================================================
 
+#include "Flops.hpp"
 #include "GSimulation.hpp"
+#include "Interaction.hpp"
+#include "Random.hpp"
+#include "SpatialSort.hpp"
 #include <CL/sycl.hpp>
+#include <algorithm>
 #include <chrono>
+#include <memory>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef NBODY_MPI
+#include <mpi.h>
+#endif
 using namespace sycl;
 
 auto exception_handler = [](exception_list list) {
@@ -26,6 +38,22 @@ auto exception_handler = [](exception_list list) {
   }
 };
 
+// Sums a value over the MPI ranks, each of them owning a slice of the
+// particles
+static double global_sum(double v) {
+#ifdef NBODY_MPI
+  MPI_Allreduce(MPI_IN_PLACE, &v, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+  return v;
+}
+
+// Returns the kinetic energy of the system from the sum of m v^2 reduced into
+// "kbuf" by the update kernel
+static accum_type kinetic_energy(buffer<accum_type>& kbuf) {
+  auto k = kbuf.get_access<access::mode::read>();
+  return 0.5 * global_sum(k[0]);
+}
+
 GSimulation ::GSimulation() {
   std::cout << "===============================" << std::endl;
   std::cout << " Initialize Gravity Simulation" << std::endl;
@@ -33,37 +61,70 @@ GSimulation ::GSimulation() {
   set_nsteps(10);
   set_tstep(0.1);
   set_sfreq(1);
+  particles = nullptr;
+  _model = Model::Cube;
+  _seed = 42;
+  _layout = Layout::AoS;
+  _pipelined = false;
+  _integrator = Integrator::Euler;
+  _blocklevels = 0;
+  _ckfreq = 0;
+  _snapfreq = 1;
+  _snapfields = SnapshotWriter::Position | SnapshotWriter::Velocity |
+                SnapshotWriter::Mass;
+  _snaperror = 0.;
+  _step0 = 0;
+  _eta = 0.02;
+  _solver = Solver::Direct;
+  _kernel = ForceKernel::Flat;
+  _softening = Softening::Plummer;
+  _rsqrt = Rsqrt::Exact;
+  _kprecision = KernelPrecision::Float;
+  _iblock = 4;
+  _force_rms = _force_max = -1.;
+  _memory = Memory::Buffer;
+  _split = Split::None;
+  _sortfreq = 0;
+  _curve = Curve::Morton;
+  _units = 1;
+  _systems = 0;
+  set_wgsize(128);
+  set_tilesize(512);
 }
 
 void GSimulation ::set_number_of_particles(int N) { set_npart(N); }
 
 void GSimulation ::set_number_of_steps(int N) { set_nsteps(N); }
 
+// The random cube draws positions, velocities and masses from separate
+// streams of a counter-based generator, so they are not correlated and every
+// particle is initialized independently in parallel.
 void GSimulation ::init_pos() {
-  std::random_device rd;  // random number generator
-  std::mt19937 gen(42);
-  std::uniform_real_distribution<real_type> unif_d(0, 1.0);
+  const Philox gen(get_seed(), 0);
 
+#pragma omp parallel for
   for (int i = 0; i < get_npart(); ++i) {
-    particles[i].pos[0] = unif_d(gen);
-    particles[i].pos[1] = unif_d(gen);
-    particles[i].pos[2] = unif_d(gen);
+    RandomStream r(gen, i);
+    particles[i].pos[0] = r.uniform();
+    particles[i].pos[1] = r.uniform();
+    particles[i].pos[2] = r.uniform();
   }
 }
 
 void GSimulation ::init_vel() {
-  std::random_device rd;  // random number generator
-  std::mt19937 gen(42);
-  std::uniform_real_distribution<real_type> unif_d(-1.0, 1.0);
+  const Philox gen(get_seed(), 1);
 
+#pragma omp parallel for
   for (int i = 0; i < get_npart(); ++i) {
-    particles[i].vel[0] = unif_d(gen) * 1.0e-3f;
-    particles[i].vel[1] = unif_d(gen) * 1.0e-3f;
-    particles[i].vel[2] = unif_d(gen) * 1.0e-3f;
+    RandomStream r(gen, i);
+    particles[i].vel[0] = r.uniform(-1.0, 1.0) * 1.0e-3f;
+    particles[i].vel[1] = r.uniform(-1.0, 1.0) * 1.0e-3f;
+    particles[i].vel[2] = r.uniform(-1.0, 1.0) * 1.0e-3f;
   }
 }
 
 void GSimulation ::init_acc() {
+#pragma omp parallel for
   for (int i = 0; i < get_npart(); ++i) {
     particles[i].acc[0] = 0.f;
     particles[i].acc[1] = 0.f;
@@ -72,160 +133,2663 @@ void GSimulation ::init_acc() {
 }
 
 void GSimulation ::init_mass() {
-  real_type n = static_cast<real_type>(get_npart());
-  std::random_device rd;  // random number generator
-  std::mt19937 gen(42);
-  std::uniform_real_distribution<real_type> unif_d(0.0, 1.0);
+  compute_type n = static_cast<compute_type>(get_npart());
+  const Philox gen(get_seed(), 2);
 
+#pragma omp parallel for
   for (int i = 0; i < get_npart(); ++i) {
-    particles[i].mass = n * unif_d(gen);
+    RandomStream r(gen, i);
+    particles[i].mass = n * r.uniform();
+  }
+}
+
+namespace {
+// One SYCL buffer for each component of the SoA container
+struct SoABuffers {
+  SoABuffers(ParticleSoA& ps, range<1> R)
+      : x(ps.pos_x, R, {property::buffer::use_host_ptr()}),
+        y(ps.pos_y, R, {property::buffer::use_host_ptr()}),
+        z(ps.pos_z, R, {property::buffer::use_host_ptr()}),
+        vx(ps.vel_x, R, {property::buffer::use_host_ptr()}),
+        vy(ps.vel_y, R, {property::buffer::use_host_ptr()}),
+        vz(ps.vel_z, R, {property::buffer::use_host_ptr()}),
+        ax(ps.acc_x, R, {property::buffer::use_host_ptr()}),
+        ay(ps.acc_y, R, {property::buffer::use_host_ptr()}),
+        az(ps.acc_z, R, {property::buffer::use_host_ptr()}),
+        m(ps.mass, R, {property::buffer::use_host_ptr()}) {}
+  buffer<real_type> x, y, z;
+  buffer<real_type> vx, vy, vz;
+  buffer<real_type> ax, ay, az;
+  buffer<real_type> m;
+};
+
+// Jerks and state at the beginning of the step of the Hermite scheme
+struct HermiteBuffers {
+  HermiteBuffers(range<1> R)
+      : jx(R), jy(R), jz(R), x0(R), y0(R), z0(R), vx0(R), vy0(R), vz0(R),
+        ax0(R), ay0(R), az0(R), jx0(R), jy0(R), jz0(R) {}
+  buffer<real_type> jx, jy, jz;
+  buffer<real_type> x0, y0, z0;
+  buffer<real_type> vx0, vy0, vz0;
+  buffer<real_type> ax0, ay0, az0;
+  buffer<real_type> jx0, jy0, jz0;
+};
+
+// Levels and times of the block time steps. A particle of level l advances by
+// 2^(levels - l) ticks of dt / 2^levels, and "tick" is the time of its last
+// correction within the current step.
+struct BlockBuffers {
+  BlockBuffers(range<1> R)
+      : level(R), tick(R), active(R), count(range<1>(1)), tnext(range<1>(1)) {}
+  buffer<int> level, tick;
+  buffer<int> active;  // compacted indices of the active particles
+  buffer<int> count;   // number of active particles
+  buffer<int> tnext;   // time of the next block
+};
+
+// First and last kernel of a time step. For the profile it also keeps the
+// force and integration kernels, the host time of the force computations, the
+// number of full force evaluations and the bytes moved by the kernels.
+struct StepEvents {
+  event first, last;
+  std::vector<event> forces, updates;
+  double host_force = 0.;
+  double evaluations = 0.;
+  double bytes = 0.;
+};
+
+// The SoA arrays in a single USM allocation of the given kind. There is no
+// dependency tracking: every kernel waits for the event of the previous one,
+// "last", and replaces it with its own. The kernels update the i-particles
+// from "begin" to "end" and read all of them as j-particles.
+struct USMArrays {
+  USMArrays(queue& q, Memory kind, const ParticleSoA& ps, int begin = 0,
+            int end = -1)
+      : q(q), stride(ps.stride), begin(begin),
+        end(end < 0 ? ps.npart : end) {
+    const std::size_t count = std::size_t(ParticleSoA::nfields) * stride;
+    if (kind == Memory::Device)
+      data = malloc_device<real_type>(count, q);
+    else if (kind == Memory::Shared)
+      data = malloc_shared<real_type>(count, q);
+    else
+      data = malloc_host<real_type>(count, q);
+    if (!data) throw std::bad_alloc();
+    real_type** fields[ParticleSoA::nfields] = {&x,  &y,  &z,  &vx, &vy,
+                                                &vz, &ax, &ay, &az, &m};
+    for (int f = 0; f < ParticleSoA::nfields; ++f) *fields[f] = data + f * stride;
+    last = q.memcpy(data, ps.data, sizeof(real_type) * count);
+  }
+  ~USMArrays() {
+    last.wait();
+    free(data, q);
+  }
+  USMArrays(const USMArrays&) = delete;
+  USMArrays& operator=(const USMArrays&) = delete;
+
+  // copies the i-particles back once the last kernel has completed
+  void store(ParticleSoA& ps) {
+    if (begin == 0 && end == ps.npart) {
+      last = q.memcpy(ps.data, data,
+                      sizeof(real_type) * ParticleSoA::nfields * stride, last);
+    } else {
+      for (int f = 0; f < ParticleSoA::nfields; ++f)
+        last = q.memcpy(ps.data + f * stride + begin,
+                        data + f * stride + begin,
+                        sizeof(real_type) * (end - begin), last);
+    }
+    last.wait();
+  }
+
+  queue& q;
+  int stride;
+  int begin, end;  // i-particles
+  real_type* data;
+  real_type *x, *y, *z;
+  real_type *vx, *vy, *vz;
+  real_type *ax, *ay, *az;
+  real_type *m;
+  event last;
+};
+
+// The particles split over several queues, one per device or sub-device.
+// Every queue keeps all the positions and masses as read-only j-particles in
+// its own device memory and integrates a slice of the i-particles. After
+// every position update the slices are gathered on the host and copied to
+// the other queues.
+struct DeviceSplit {
+  DeviceSplit(const std::vector<device>& devices, ParticleSoA& ps) : host(ps) {
+    // the slices are proportional to the compute units of the devices
+    double units = 0.;
+    for (const device& d : devices)
+      units += d.get_info<info::device::max_compute_units>();
+    queues.reserve(devices.size());
+    int begin = 0;
+    double sum = 0.;
+    for (std::size_t k = 0; k < devices.size(); ++k) {
+      queues.emplace_back(devices[k], exception_handler,
+                          property_list{property::queue::enable_profiling()});
+      sum += devices[k].get_info<info::device::max_compute_units>();
+      const int end = k + 1 == devices.size()
+                          ? ps.npart
+                          : int(double(ps.npart) * sum / units + 0.5);
+      parts.emplace_back(
+          new USMArrays(queues.back(), Memory::Device, ps, begin, end));
+      ksums.emplace_back(new buffer<accum_type>(range<1>(1)));
+      begin = end;
+    }
+    // the host arrays are the staging area of the exchange
+    for (auto& p : parts) p->last.wait();
+  }
+
+  // copies the positions of every slice to the other queues
+  void exchange() {
+    const int stride = host.stride;
+    for (auto& p : parts)
+      for (int f = 0; f < 3; ++f)
+        p->last = p->q.memcpy(host.data + f * stride + p->begin,
+                              p->data + f * stride + p->begin,
+                              sizeof(real_type) * (p->end - p->begin),
+                              p->last);
+    for (auto& p : parts) p->last.wait();
+    for (auto& p : parts)
+      for (auto& o : parts) {
+        if (o == p) continue;
+        for (int f = 0; f < 3; ++f)
+          p->last = p->q.memcpy(p->data + f * stride + o->begin,
+                                host.data + f * stride + o->begin,
+                                sizeof(real_type) * (o->end - o->begin),
+                                p->last);
+      }
+  }
+
+  // sums m v^2 of the slices into ksum
+  void reduce(buffer<accum_type>& ksum) {
+    accum_type sum = 0.;
+    for (auto& k : ksums) sum += k->get_access<access::mode::read>()[0];
+    ksum.get_access<access::mode::write>()[0] = sum;
+  }
+
+  void store(ParticleSoA& ps) {
+    for (auto& p : parts) p->store(ps);
+  }
+
+  std::vector<queue> queues;
+  std::vector<std::unique_ptr<USMArrays>> parts;
+  std::vector<std::unique_ptr<buffer<accum_type>>> ksums;
+  ParticleSoA& host;  // staging of the exchange
+};
+
+#ifdef NBODY_MPI
+// Systolic ring of the MPI ranks. Every rank owns a contiguous slice of the
+// particles, and the positions and masses of all the slices travel once around
+// the ring per force evaluation, as blocks of x, y, z and mass arrays stored
+// one after the other.
+struct Ring {
+  explicit Ring(int n) {
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    for (int r = 0; r <= size; ++r)
+      offsets.push_back(int(int64_t(n) * r / size));
+    int cap = 0;
+    for (int r = 0; r < size; ++r) cap = std::max(cap, count(r));
+    for (auto& blk : blocks) blk.resize(4 * std::size_t(cap));
+  }
+
+  int count(int r) const { return offsets[r + 1] - offsets[r]; }
+  int first() const { return offsets[rank]; }
+  int total() const { return offsets[size]; }
+
+  int rank, size;
+  std::vector<int> offsets;           // first particle of every rank
+  std::vector<real_type> blocks[2];   // block of this round and of the next
+};
+#endif
+}  // namespace
+
+static const char* precision_name(std::size_t bytes) {
+  return bytes == 2 ? "half" : bytes == 4 ? "float" : "double";
+}
+
+// m v^2 of one particle, in the precision of the energy reduction
+static inline accum_type kinetic_term(compute_type m, compute_type vx,
+                                      compute_type vy, compute_type vz) {
+  return accum_type(m) * (vx * vx + vy * vy + vz * vz);
+}
+
+static event force_aos(queue& q, buffer<Particle>& pbuf, int n) {
+  return q.submit([&](handler& h) {
+    auto p = pbuf.get_access<access::mode::read_write>(h);
+    h.parallel_for(range<1>(n), [=](id<1> i) {
+      accum_type acc0 = p[i].acc[0];
+      accum_type acc1 = p[i].acc[1];
+      accum_type acc2 = p[i].acc[2];
+      for (int j = 0; j < n; j++) {
+        compute_type dx, dy, dz;
+        compute_type distanceSqr = 0.0;
+        compute_type distanceInv = 0.0;
+
+        dx = compute_type(p[j].pos[0]) - compute_type(p[i].pos[0]);  // 1flop
+        dy = compute_type(p[j].pos[1]) - compute_type(p[i].pos[1]);  // 1flop
+        dz = compute_type(p[j].pos[2]) - compute_type(p[i].pos[2]);  // 1flop
+
+        distanceSqr =
+            dx * dx + dy * dy + dz * dz + softeningSquared;  // 6flops
+        distanceInv = 1.0 / sycl::sqrt(distanceSqr);         // 1div+1sqrt
+
+        acc0 += dx * G * compute_type(p[j].mass) * distanceInv * distanceInv *
+                distanceInv;  // 6flops
+        acc1 += dy * G * compute_type(p[j].mass) * distanceInv * distanceInv *
+                distanceInv;  // 6flops
+        acc2 += dz * G * compute_type(p[j].mass) * distanceInv * distanceInv *
+                distanceInv;  // 6flops
+      }
+      p[i].acc[0] = acc0;
+      p[i].acc[1] = acc1;
+      p[i].acc[2] = acc2;
+    });
+  });
+}
+
+// Advances the particles by one step. If "ksum" is given, the sum of m v^2 is
+// reduced into it on the fly.
+static event update_aos(queue& q, buffer<Particle>& pbuf, int n, compute_type dt,
+                        buffer<accum_type>* ksum) {
+  return q.submit([&](handler& h) {
+    auto p = pbuf.get_access<access::mode::read_write>(h);
+    auto kick_drift = [=](int i) {
+      p[i].vel[0] += p[i].acc[0] * dt;  // 2flops
+      p[i].vel[1] += p[i].acc[1] * dt;  // 2flops
+      p[i].vel[2] += p[i].acc[2] * dt;  // 2flops
+
+      p[i].pos[0] += p[i].vel[0] * dt;  // 2flops
+      p[i].pos[1] += p[i].vel[1] * dt;  // 2flops
+      p[i].pos[2] += p[i].vel[2] * dt;  // 2flops
+
+      p[i].acc[0] = 0.;
+      p[i].acc[1] = 0.;
+      p[i].acc[2] = 0.;
+
+      return kinetic_term(p[i].mass, p[i].vel[0], p[i].vel[1],
+                          p[i].vel[2]);  // 7flops
+    };
+    if (ksum) {
+      auto sum = reduction(*ksum, h, sycl::plus<accum_type>(),
+                           {property::reduction::initialize_to_identity()});
+      h.parallel_for(range<1>(n), sum,
+                     [=](id<1> i, auto& e) { e += kick_drift(i); });
+    } else {
+      h.parallel_for(range<1>(n), [=](id<1> i) { kick_drift(i); });
+    }
+  });
+}
+
+static event force_soa(queue& q, SoABuffers& b, int n) {
+  return q.submit([&](handler& h) {
+    auto x = b.x.get_access<access::mode::read>(h);
+    auto y = b.y.get_access<access::mode::read>(h);
+    auto z = b.z.get_access<access::mode::read>(h);
+    auto m = b.m.get_access<access::mode::read>(h);
+    auto ax = b.ax.get_access<access::mode::read_write>(h);
+    auto ay = b.ay.get_access<access::mode::read_write>(h);
+    auto az = b.az.get_access<access::mode::read_write>(h);
+    h.parallel_for(range<1>(n), [=](id<1> i) {
+      const compute_type xi = x[i];
+      const compute_type yi = y[i];
+      const compute_type zi = z[i];
+      accum_type acc0 = ax[i];
+      accum_type acc1 = ay[i];
+      accum_type acc2 = az[i];
+      for (int j = 0; j < n; j++) {
+        compute_type dx, dy, dz;
+        compute_type distanceSqr = 0.0;
+        compute_type distanceInv = 0.0;
+
+        dx = compute_type(x[j]) - xi;  // 1flop
+        dy = compute_type(y[j]) - yi;  // 1flop
+        dz = compute_type(z[j]) - zi;  // 1flop
+
+        distanceSqr =
+            dx * dx + dy * dy + dz * dz + softeningSquared;  // 6flops
+        distanceInv = 1.0 / sycl::sqrt(distanceSqr);         // 1div+1sqrt
+
+        acc0 += dx * G * compute_type(m[j]) * distanceInv * distanceInv *
+                distanceInv;  // 6flops
+        acc1 += dy * G * compute_type(m[j]) * distanceInv * distanceInv *
+                distanceInv;  // 6flops
+        acc2 += dz * G * compute_type(m[j]) * distanceInv * distanceInv *
+                distanceInv;  // 6flops
+      }
+      ax[i] = acc0;
+      ay[i] = acc1;
+      az[i] = acc2;
+    });
+  });
+}
+
+// Work-group tiled variant: every work-group stages a tile of j-particles into
+// local memory once and all its work-items reuse it
+static event force_tiled_soa(queue& q, SoABuffers& b, int n, int wgsize,
+                             int tilesize) {
+  auto G_R = range<1>(((n + wgsize - 1) / wgsize) * wgsize);
+  return q.submit([&](handler& h) {
+    auto x = b.x.get_access<access::mode::read>(h);
+    auto y = b.y.get_access<access::mode::read>(h);
+    auto z = b.z.get_access<access::mode::read>(h);
+    auto m = b.m.get_access<access::mode::read>(h);
+    auto ax = b.ax.get_access<access::mode::read_write>(h);
+    auto ay = b.ay.get_access<access::mode::read_write>(h);
+    auto az = b.az.get_access<access::mode::read_write>(h);
+    local_accessor<real_type, 1> tx(range<1>(tilesize), h);
+    local_accessor<real_type, 1> ty(range<1>(tilesize), h);
+    local_accessor<real_type, 1> tz(range<1>(tilesize), h);
+    local_accessor<real_type, 1> tm(range<1>(tilesize), h);
+    h.parallel_for(nd_range<1>(G_R, range<1>(wgsize)), [=](nd_item<1> it) {
+      const int i = it.get_global_id(0);
+      // the padding work-items of the last group only help loading
+      const bool active = i < n;
+      const compute_type xi = active ? compute_type(x[i]) : 0;
+      const compute_type yi = active ? compute_type(y[i]) : 0;
+      const compute_type zi = active ? compute_type(z[i]) : 0;
+      accum_type acc0 = active ? accum_type(ax[i]) : 0;
+      accum_type acc1 = active ? accum_type(ay[i]) : 0;
+      accum_type acc2 = active ? accum_type(az[i]) : 0;
+      tiled_accelerations(it, wgsize, tilesize, x, y, z, m, 0, n, tx, ty, tz,
+                          tm, xi, yi, zi, acc0, acc1, acc2);
+      if (active) {
+        ax[i] = acc0;
+        ay[i] = acc1;
+        az[i] = acc2;
+      }
+    });
+  });
+}
+
+// Register-blocked variant: every work-item owns B i-particles, i = t + k nwi
+// for k < B with nwi work-items, and applies each j-particle it loads to all
+// of them, so a load is amortised over B interactions. B is a constant, the
+// loops over k are unrolled and the i-particles stay in registers. The
+// arithmetic of a pair is the one of the flat kernel.
+template <int B>
+static event force_blocked_soa(queue& q, SoABuffers& b, int n) {
+  const int nwi = (n + B - 1) / B;
+  return q.submit([&](handler& h) {
+    auto x = b.x.get_access<access::mode::read>(h);
+    auto y = b.y.get_access<access::mode::read>(h);
+    auto z = b.z.get_access<access::mode::read>(h);
+    auto m = b.m.get_access<access::mode::read>(h);
+    auto ax = b.ax.get_access<access::mode::read_write>(h);
+    auto ay = b.ay.get_access<access::mode::read_write>(h);
+    auto az = b.az.get_access<access::mode::read_write>(h);
+    h.parallel_for(range<1>(nwi), [=](id<1> t) {
+      compute_type xi[B], yi[B], zi[B];
+      accum_type acc0[B], acc1[B], acc2[B];
+      for (int k = 0; k < B; k++) {
+        // the padding i-particles of the last work-items compute on zeros
+        const int i = t + k * nwi;
+        const bool active = i < n;
+        xi[k] = active ? compute_type(x[i]) : 0;
+        yi[k] = active ? compute_type(y[i]) : 0;
+        zi[k] = active ? compute_type(z[i]) : 0;
+        acc0[k] = active ? accum_type(ax[i]) : 0;
+        acc1[k] = active ? accum_type(ay[i]) : 0;
+        acc2[k] = active ? accum_type(az[i]) : 0;
+      }
+      for (int j = 0; j < n; j++) {
+        const compute_type xj = x[j];
+        const compute_type yj = y[j];
+        const compute_type zj = z[j];
+        const compute_type mj = m[j];
+        for (int k = 0; k < B; k++) {
+          compute_type dx, dy, dz;
+          compute_type distanceSqr = 0.0;
+          compute_type distanceInv = 0.0;
+
+          dx = xj - xi[k];  // 1flop
+          dy = yj - yi[k];  // 1flop
+          dz = zj - zi[k];  // 1flop
+
+          distanceSqr =
+              dx * dx + dy * dy + dz * dz + softeningSquared;  // 6flops
+          distanceInv = 1.0 / sycl::sqrt(distanceSqr);         // 1div+1sqrt
+
+          acc0[k] += dx * G * mj * distanceInv * distanceInv *
+                     distanceInv;  // 6flops
+          acc1[k] += dy * G * mj * distanceInv * distanceInv *
+                     distanceInv;  // 6flops
+          acc2[k] += dz * G * mj * distanceInv * distanceInv *
+                     distanceInv;  // 6flops
+        }
+      }
+      for (int k = 0; k < B; k++) {
+        const int i = t + k * nwi;
+        if (i < n) {
+          ax[i] = acc0[k];
+          ay[i] = acc1[k];
+          az[i] = acc2[k];
+        }
+      }
+    });
+  });
+}
+
+// Selects the register-blocked kernel of "iblock" i-particles per work-item
+static event force_blocked_soa(queue& q, SoABuffers& b, int n, int iblock) {
+  if (iblock == 2) return force_blocked_soa<2>(q, b, n);
+  if (iblock == 8) return force_blocked_soa<8>(q, b, n);
+  return force_blocked_soa<4>(q, b, n);
+}
+
+// Symmetric variant for CPU devices: every pair is computed once and its equal
+// and opposite contributions are scattered into the accumulators of the
+// work-item, a slice of 3 n values per work-item in "scratch". The pairs of
+// tiles (a, b) with a <= b are dealt out to the "nthreads" work-items in turn,
+// and a second kernel sums the slices into the accelerations. Returns the
+// event of the sum; the one of the pair kernel is added to "kernels" if set.
+static event force_symmetric_soa(queue& q, SoABuffers& b,
+                                 buffer<accum_type>& scratch, int n,
+                                 int nthreads, int tile,
+                                 std::vector<event>* kernels = nullptr) {
+  const int ntiles = (n + tile - 1) / tile;
+  event pairs = q.submit([&](handler& h) {
+    auto x = b.x.get_access<access::mode::read>(h);
+    auto y = b.y.get_access<access::mode::read>(h);
+    auto z = b.z.get_access<access::mode::read>(h);
+    auto m = b.m.get_access<access::mode::read>(h);
+    auto acc = scratch.get_access<access::mode::discard_write>(h);
+    h.parallel_for(range<1>(nthreads), [=](id<1> t) {
+      const std::size_t ox = std::size_t(t[0]) * 3 * n;
+      const std::size_t oy = ox + n;
+      const std::size_t oz = oy + n;
+      for (int i = 0; i < 3 * n; ++i) acc[ox + i] = 0;
+      int p = 0;
+      for (int ta = 0; ta < ntiles; ++ta) {
+        for (int tb = ta; tb < ntiles; ++tb, ++p) {
+          if (p % nthreads != int(t[0])) continue;
+          const int iend = std::min(n, (ta + 1) * tile);
+          const int jend = std::min(n, (tb + 1) * tile);
+          for (int i = ta * tile; i < iend; ++i) {
+            const compute_type xi = x[i];
+            const compute_type yi = y[i];
+            const compute_type zi = z[i];
+            const compute_type mi = m[i];
+            accum_type acc0 = 0;
+            accum_type acc1 = 0;
+            accum_type acc2 = 0;
+            // the diagonal tile only holds the pairs j > i
+            for (int j = ta == tb ? i + 1 : tb * tile; j < jend; ++j) {
+              const compute_type dx = compute_type(x[j]) - xi;  // 1flop
+              const compute_type dy = compute_type(y[j]) - yi;  // 1flop
+              const compute_type dz = compute_type(z[j]) - zi;  // 1flop
+              const compute_type distanceSqr =
+                  dx * dx + dy * dy + dz * dz + softeningSquared;  // 6flops
+              const compute_type distanceInv =
+                  1.0 / sycl::sqrt(distanceSqr);  // 1div+1sqrt
+              const compute_type distanceInv3 =
+                  distanceInv * distanceInv * distanceInv;  // 2flops
+              const compute_type si = compute_type(m[j]) * distanceInv3;
+              const compute_type sj = mi * distanceInv3;  // 2flops
+              acc0 += dx * si;  // 6flops
+              acc1 += dy * si;
+              acc2 += dz * si;
+              acc[ox + j] -= dx * sj;  // 6flops
+              acc[oy + j] -= dy * sj;
+              acc[oz + j] -= dz * sj;
+            }
+            acc[ox + i] += acc0;
+            acc[oy + i] += acc1;
+            acc[oz + i] += acc2;
+          }
+        }
+      }
+    });
+  });
+  if (kernels) kernels->push_back(pairs);
+  return q.submit([&](handler& h) {
+    auto acc = scratch.get_access<access::mode::read>(h);
+    auto ax = b.ax.get_access<access::mode::read_write>(h);
+    auto ay = b.ay.get_access<access::mode::read_write>(h);
+    auto az = b.az.get_access<access::mode::read_write>(h);
+    h.parallel_for(range<1>(n), [=](id<1> i) {
+      accum_type acc0 = 0;
+      accum_type acc1 = 0;
+      accum_type acc2 = 0;
+      for (int t = 0; t < nthreads; ++t) {
+        const std::size_t o = std::size_t(t) * 3 * n + i[0];
+        acc0 += acc[o];
+        acc1 += acc[o + n];
+        acc2 += acc[o + 2 * n];
+      }
+      ax[i] += G * acc0;
+      ay[i] += G * acc1;
+      az[i] += G * acc2;
+    });
+  });
+}
+
+// Copies G m into "gm", in the precision of the specialised kernels
+template <class T>
+static event fold_masses(queue& q, SoABuffers& b, buffer<T>& gm, int n) {
+  return q.submit([&](handler& h) {
+    auto m = b.m.get_access<access::mode::read>(h);
+    auto g = gm.template get_access<access::mode::discard_write>(h);
+    h.parallel_for(range<1>(n), [=](id<1> i) { g[i] = T(G) * T(m[i]); });
+  });
+}
+
+// Flat kernel specialised at compile time on the softening law, the
+// evaluation of the inverse square root and the precision T of the
+// arithmetic. The masses come premultiplied by G from "gm", and the factor
+// f(r^2) of a pair is computed once for the three components. The
+// accelerations are added to ax, ay and az.
+template <Softening S, Rsqrt R, class T>
+static event force_specialized_soa(queue& q, SoABuffers& b, buffer<T>& gm,
+                                   buffer<real_type>& bx,
+                                   buffer<real_type>& by,
+                                   buffer<real_type>& bz, int n) {
+  return q.submit([&](handler& h) {
+    auto x = b.x.get_access<access::mode::read>(h);
+    auto y = b.y.get_access<access::mode::read>(h);
+    auto z = b.z.get_access<access::mode::read>(h);
+    auto g = gm.template get_access<access::mode::read>(h);
+    auto ax = bx.get_access<access::mode::read_write>(h);
+    auto ay = by.get_access<access::mode::read_write>(h);
+    auto az = bz.get_access<access::mode::read_write>(h);
+    h.parallel_for(range<1>(n), [=](id<1> i) {
+      const T xi = x[i];
+      const T yi = y[i];
+      const T zi = z[i];
+      T acc0 = 0, acc1 = 0, acc2 = 0;
+      for (int j = 0; j < n; j++) {
+        const T dx = T(x[j]) - xi;  // 1flop
+        const T dy = T(y[j]) - yi;  // 1flop
+        const T dz = T(z[j]) - zi;  // 1flop
+        const T s =
+            g[j] * inverse_cube<S, R>(dx * dx + dy * dy + dz * dz);  // 11flops
+        acc0 += dx * s;  // 2flops
+        acc1 += dy * s;  // 2flops
+        acc2 += dz * s;  // 2flops
+      }
+      ax[i] += acc0;
+      ay[i] += acc1;
+      az[i] += acc2;
+    });
+  });
+}
+
+// Selects the specialised kernel of the variant
+template <class T>
+static event force_specialized_soa(queue& q, SoABuffers& b, buffer<T>& gm,
+                                   buffer<real_type>& ax,
+                                   buffer<real_type>& ay,
+                                   buffer<real_type>& az, int n,
+                                   Softening softening, Rsqrt rsqrt) {
+  if (softening == Softening::Plummer) {
+    if (rsqrt == Rsqrt::Native)
+      return force_specialized_soa<Softening::Plummer, Rsqrt::Native>(
+          q, b, gm, ax, ay, az, n);
+    if (rsqrt == Rsqrt::Newton)
+      return force_specialized_soa<Softening::Plummer, Rsqrt::Newton>(
+          q, b, gm, ax, ay, az, n);
+    return force_specialized_soa<Softening::Plummer, Rsqrt::Exact>(
+        q, b, gm, ax, ay, az, n);
+  }
+  if (rsqrt == Rsqrt::Native)
+    return force_specialized_soa<Softening::Spline, Rsqrt::Native>(
+        q, b, gm, ax, ay, az, n);
+  if (rsqrt == Rsqrt::Newton)
+    return force_specialized_soa<Softening::Spline, Rsqrt::Newton>(
+        q, b, gm, ax, ay, az, n);
+  return force_specialized_soa<Softening::Spline, Rsqrt::Exact>(
+      q, b, gm, ax, ay, az, n);
+}
+
+// Relative error of the accelerations "ax", "ay" and "az" of the first
+// "nsample" particles against the direct sum in double precision with exact
+// square roots and the same softening law, computed on the host. Returns
+// the root mean square and stores the maximum in "maxerr".
+static double force_error(SoABuffers& b, buffer<real_type>& bx,
+                          buffer<real_type>& by, buffer<real_type>& bz, int n,
+                          int nsample, Softening softening, double* maxerr) {
+  auto x = b.x.get_access<access::mode::read>();
+  auto y = b.y.get_access<access::mode::read>();
+  auto z = b.z.get_access<access::mode::read>();
+  auto m = b.m.get_access<access::mode::read>();
+  auto ax = bx.get_access<access::mode::read>();
+  auto ay = by.get_access<access::mode::read>();
+  auto az = bz.get_access<access::mode::read>();
+  double sum2 = 0., emax = 0.;
+#pragma omp parallel for reduction(+ : sum2) reduction(max : emax)
+  for (int i = 0; i < nsample; ++i) {
+    double r[3] = {0., 0., 0.};
+    for (int j = 0; j < n; ++j) {
+      const double d[3] = {double(x[j]) - double(x[i]),
+                           double(y[j]) - double(y[i]),
+                           double(z[j]) - double(z[i])};
+      const double r2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+      const double f =
+          softening == Softening::Plummer
+              ? inverse_cube<Softening::Plummer, Rsqrt::Exact>(r2)
+              : inverse_cube<Softening::Spline, Rsqrt::Exact>(r2);
+      for (int k = 0; k < 3; ++k) r[k] += double(G) * double(m[j]) * d[k] * f;
+    }
+    const double e[3] = {double(ax[i]) - r[0], double(ay[i]) - r[1],
+                         double(az[i]) - r[2]};
+    const double norm = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+    if (norm == 0.) continue;
+    const double err =
+        std::sqrt(e[0] * e[0] + e[1] * e[1] + e[2] * e[2]) / norm;
+    sum2 += err * err;
+    emax = std::max(emax, err);
+  }
+  *maxerr = emax;
+  return std::sqrt(sum2 / nsample);
+}
+
+static event update_soa(queue& q, SoABuffers& b, int n, compute_type dt,
+                        buffer<accum_type>* ksum) {
+  return q.submit([&](handler& h) {
+    auto x = b.x.get_access<access::mode::read_write>(h);
+    auto y = b.y.get_access<access::mode::read_write>(h);
+    auto z = b.z.get_access<access::mode::read_write>(h);
+    auto vx = b.vx.get_access<access::mode::read_write>(h);
+    auto vy = b.vy.get_access<access::mode::read_write>(h);
+    auto vz = b.vz.get_access<access::mode::read_write>(h);
+    auto ax = b.ax.get_access<access::mode::read_write>(h);
+    auto ay = b.ay.get_access<access::mode::read_write>(h);
+    auto az = b.az.get_access<access::mode::read_write>(h);
+    auto m = b.m.get_access<access::mode::read>(h);
+    auto kick_drift = [=](int i) {
+      vx[i] += ax[i] * dt;  // 2flops
+      vy[i] += ay[i] * dt;  // 2flops
+      vz[i] += az[i] * dt;  // 2flops
+
+      x[i] += vx[i] * dt;  // 2flops
+      y[i] += vy[i] * dt;  // 2flops
+      z[i] += vz[i] * dt;  // 2flops
+
+      ax[i] = 0.;
+      ay[i] = 0.;
+      az[i] = 0.;
+
+      return kinetic_term(m[i], vx[i], vy[i], vz[i]);  // 7flops
+    };
+    if (ksum) {
+      auto sum = reduction(*ksum, h, sycl::plus<accum_type>(),
+                           {property::reduction::initialize_to_identity()});
+      h.parallel_for(range<1>(n), sum,
+                     [=](id<1> i, auto& e) { e += kick_drift(i); });
+    } else {
+      h.parallel_for(range<1>(n), [=](id<1> i) { kick_drift(i); });
+    }
+  });
+}
+
+// Velocity update of the kick-drift-kick schemes, v += a tau. If "ksum" is
+// given, the sum of m v^2 is reduced into it on the fly.
+static event kick_soa(queue& q, SoABuffers& b, int n, compute_type tau,
+                      buffer<accum_type>* ksum) {
+  return q.submit([&](handler& h) {
+    auto vx = b.vx.get_access<access::mode::read_write>(h);
+    auto vy = b.vy.get_access<access::mode::read_write>(h);
+    auto vz = b.vz.get_access<access::mode::read_write>(h);
+    auto ax = b.ax.get_access<access::mode::read>(h);
+    auto ay = b.ay.get_access<access::mode::read>(h);
+    auto az = b.az.get_access<access::mode::read>(h);
+    auto m = b.m.get_access<access::mode::read>(h);
+    auto kick = [=](int i) {
+      vx[i] += ax[i] * tau;  // 2flops
+      vy[i] += ay[i] * tau;  // 2flops
+      vz[i] += az[i] * tau;  // 2flops
+
+      return kinetic_term(m[i], vx[i], vy[i], vz[i]);  // 7flops
+    };
+    if (ksum) {
+      auto sum = reduction(*ksum, h, sycl::plus<accum_type>(),
+                           {property::reduction::initialize_to_identity()});
+      h.parallel_for(range<1>(n), sum,
+                     [=](id<1> i, auto& e) { e += kick(i); });
+    } else {
+      h.parallel_for(range<1>(n), [=](id<1> i) { kick(i); });
+    }
+  });
+}
+
+// Position update of the kick-drift-kick schemes, x += v tau. The
+// accelerations are cleared for the next force computation.
+static event drift_soa(queue& q, SoABuffers& b, int n, compute_type tau) {
+  return q.submit([&](handler& h) {
+    auto x = b.x.get_access<access::mode::read_write>(h);
+    auto y = b.y.get_access<access::mode::read_write>(h);
+    auto z = b.z.get_access<access::mode::read_write>(h);
+    auto vx = b.vx.get_access<access::mode::read>(h);
+    auto vy = b.vy.get_access<access::mode::read>(h);
+    auto vz = b.vz.get_access<access::mode::read>(h);
+    auto ax = b.ax.get_access<access::mode::discard_write>(h);
+    auto ay = b.ay.get_access<access::mode::discard_write>(h);
+    auto az = b.az.get_access<access::mode::discard_write>(h);
+    h.parallel_for(range<1>(n), [=](id<1> i) {
+      x[i] += vx[i] * tau;  // 2flops
+      y[i] += vy[i] * tau;  // 2flops
+      z[i] += vz[i] * tau;  // 2flops
+
+      ax[i] = 0.;
+      ay[i] = 0.;
+      az[i] = 0.;
+    });
+  });
+}
+
+// USM variants of the flat and tiled force kernels and of the integration
+// kernels. The arrays are captured as pointers, every kernel depends on the
+// event of the previous one and only updates the i-particles of "u", so the
+// integration kernels ignore the total number of particles.
+static event force_soa(queue& q, USMArrays& u, int n) {
+  u.last = q.submit([&](handler& h) {
+    h.depends_on(u.last);
+    const real_type* x = u.x;
+    const real_type* y = u.y;
+    const real_type* z = u.z;
+    const real_type* m = u.m;
+    real_type* ax = u.ax;
+    real_type* ay = u.ay;
+    real_type* az = u.az;
+    const int begin = u.begin;
+    h.parallel_for(range<1>(u.end - begin), [=](id<1> k) {
+      const int i = begin + k;
+      const compute_type xi = x[i];
+      const compute_type yi = y[i];
+      const compute_type zi = z[i];
+      accum_type acc0 = ax[i];
+      accum_type acc1 = ay[i];
+      accum_type acc2 = az[i];
+      for (int j = 0; j < n; j++) {
+        compute_type dx, dy, dz;
+        compute_type distanceSqr = 0.0;
+        compute_type distanceInv = 0.0;
+
+        dx = compute_type(x[j]) - xi;  // 1flop
+        dy = compute_type(y[j]) - yi;  // 1flop
+        dz = compute_type(z[j]) - zi;  // 1flop
+
+        distanceSqr =
+            dx * dx + dy * dy + dz * dz + softeningSquared;  // 6flops
+        distanceInv = 1.0 / sycl::sqrt(distanceSqr);         // 1div+1sqrt
+
+        acc0 += dx * G * compute_type(m[j]) * distanceInv * distanceInv *
+                distanceInv;  // 6flops
+        acc1 += dy * G * compute_type(m[j]) * distanceInv * distanceInv *
+                distanceInv;  // 6flops
+        acc2 += dz * G * compute_type(m[j]) * distanceInv * distanceInv *
+                distanceInv;  // 6flops
+      }
+      ax[i] = acc0;
+      ay[i] = acc1;
+      az[i] = acc2;
+    });
+  });
+  return u.last;
+}
+
+static event force_tiled_soa(queue& q, USMArrays& u, int n, int wgsize,
+                             int tilesize) {
+  const int ni = u.end - u.begin;
+  auto G_R = range<1>(((ni + wgsize - 1) / wgsize) * wgsize);
+  u.last = q.submit([&](handler& h) {
+    h.depends_on(u.last);
+    const real_type* x = u.x;
+    const real_type* y = u.y;
+    const real_type* z = u.z;
+    const real_type* m = u.m;
+    real_type* ax = u.ax;
+    real_type* ay = u.ay;
+    real_type* az = u.az;
+    local_accessor<real_type, 1> tx(range<1>(tilesize), h);
+    local_accessor<real_type, 1> ty(range<1>(tilesize), h);
+    local_accessor<real_type, 1> tz(range<1>(tilesize), h);
+    local_accessor<real_type, 1> tm(range<1>(tilesize), h);
+    const int begin = u.begin;
+    h.parallel_for(nd_range<1>(G_R, range<1>(wgsize)), [=](nd_item<1> it) {
+      const int i = begin + it.get_global_id(0);
+      const bool active = i < begin + ni;
+      const compute_type xi = active ? compute_type(x[i]) : 0;
+      const compute_type yi = active ? compute_type(y[i]) : 0;
+      const compute_type zi = active ? compute_type(z[i]) : 0;
+      accum_type acc0 = active ? accum_type(ax[i]) : 0;
+      accum_type acc1 = active ? accum_type(ay[i]) : 0;
+      accum_type acc2 = active ? accum_type(az[i]) : 0;
+      tiled_accelerations(it, wgsize, tilesize, x, y, z, m, 0, n, tx, ty, tz,
+                          tm, xi, yi, zi, acc0, acc1, acc2);
+      if (active) {
+        ax[i] = acc0;
+        ay[i] = acc1;
+        az[i] = acc2;
+      }
+    });
+  });
+  return u.last;
+}
+
+static event update_soa(queue& q, USMArrays& u, int, compute_type dt,
+                        buffer<accum_type>* ksum) {
+  u.last = q.submit([&](handler& h) {
+    h.depends_on(u.last);
+    real_type* x = u.x;
+    real_type* y = u.y;
+    real_type* z = u.z;
+    real_type* vx = u.vx;
+    real_type* vy = u.vy;
+    real_type* vz = u.vz;
+    real_type* ax = u.ax;
+    real_type* ay = u.ay;
+    real_type* az = u.az;
+    const real_type* m = u.m;
+    const int begin = u.begin;
+    auto kick_drift = [=](int i) {
+      vx[i] += ax[i] * dt;  // 2flops
+      vy[i] += ay[i] * dt;  // 2flops
+      vz[i] += az[i] * dt;  // 2flops
+
+      x[i] += vx[i] * dt;  // 2flops
+      y[i] += vy[i] * dt;  // 2flops
+      z[i] += vz[i] * dt;  // 2flops
+
+      ax[i] = 0.;
+      ay[i] = 0.;
+      az[i] = 0.;
+
+      return kinetic_term(m[i], vx[i], vy[i], vz[i]);  // 7flops
+    };
+    if (ksum) {
+      auto sum = reduction(*ksum, h, sycl::plus<accum_type>(),
+                           {property::reduction::initialize_to_identity()});
+      h.parallel_for(range<1>(u.end - begin), sum,
+                     [=](id<1> i, auto& e) { e += kick_drift(begin + i); });
+    } else {
+      h.parallel_for(range<1>(u.end - begin),
+                     [=](id<1> i) { kick_drift(begin + i); });
+    }
+  });
+  return u.last;
+}
+
+static event kick_soa(queue& q, USMArrays& u, int, compute_type tau,
+                      buffer<accum_type>* ksum) {
+  u.last = q.submit([&](handler& h) {
+    h.depends_on(u.last);
+    real_type* vx = u.vx;
+    real_type* vy = u.vy;
+    real_type* vz = u.vz;
+    const real_type* ax = u.ax;
+    const real_type* ay = u.ay;
+    const real_type* az = u.az;
+    const real_type* m = u.m;
+    const int begin = u.begin;
+    auto kick = [=](int i) {
+      vx[i] += ax[i] * tau;  // 2flops
+      vy[i] += ay[i] * tau;  // 2flops
+      vz[i] += az[i] * tau;  // 2flops
+
+      return kinetic_term(m[i], vx[i], vy[i], vz[i]);  // 7flops
+    };
+    if (ksum) {
+      auto sum = reduction(*ksum, h, sycl::plus<accum_type>(),
+                           {property::reduction::initialize_to_identity()});
+      h.parallel_for(range<1>(u.end - begin), sum,
+                     [=](id<1> i, auto& e) { e += kick(begin + i); });
+    } else {
+      h.parallel_for(range<1>(u.end - begin),
+                     [=](id<1> i) { kick(begin + i); });
+    }
+  });
+  return u.last;
+}
+
+static event drift_soa(queue& q, USMArrays& u, int, compute_type tau) {
+  u.last = q.submit([&](handler& h) {
+    h.depends_on(u.last);
+    real_type* x = u.x;
+    real_type* y = u.y;
+    real_type* z = u.z;
+    const real_type* vx = u.vx;
+    const real_type* vy = u.vy;
+    const real_type* vz = u.vz;
+    real_type* ax = u.ax;
+    real_type* ay = u.ay;
+    real_type* az = u.az;
+    const int begin = u.begin;
+    h.parallel_for(range<1>(u.end - begin), [=](id<1> k) {
+      const int i = begin + k;
+      x[i] += vx[i] * tau;  // 2flops
+      y[i] += vy[i] * tau;  // 2flops
+      z[i] += vz[i] * tau;  // 2flops
+
+      ax[i] = 0.;
+      ay[i] = 0.;
+      az[i] = 0.;
+    });
+  });
+  return u.last;
+}
+
+// The kernels of a device split run on every slice. The position updates are
+// followed by the exchange, and the m v^2 of the slices are summed on the
+// host.
+static event force_soa(queue&, DeviceSplit& d, int n) {
+  for (auto& p : d.parts) force_soa(p->q, *p, n);
+  return d.parts[0]->last;
+}
+
+static event force_tiled_soa(queue&, DeviceSplit& d, int n, int wgsize,
+                             int tilesize) {
+  for (auto& p : d.parts) force_tiled_soa(p->q, *p, n, wgsize, tilesize);
+  return d.parts[0]->last;
+}
+
+static event update_soa(queue&, DeviceSplit& d, int n, compute_type dt,
+                        buffer<accum_type>* ksum) {
+  for (std::size_t k = 0; k < d.parts.size(); ++k)
+    update_soa(d.queues[k], *d.parts[k], n, dt,
+               ksum ? d.ksums[k].get() : nullptr);
+  d.exchange();
+  if (ksum) d.reduce(*ksum);
+  return d.parts[0]->last;
+}
+
+static event kick_soa(queue&, DeviceSplit& d, int n, compute_type tau,
+                      buffer<accum_type>* ksum) {
+  for (std::size_t k = 0; k < d.parts.size(); ++k)
+    kick_soa(d.queues[k], *d.parts[k], n, tau,
+             ksum ? d.ksums[k].get() : nullptr);
+  if (ksum) d.reduce(*ksum);
+  return d.parts[0]->last;
+}
+
+static event drift_soa(queue&, DeviceSplit& d, int n, compute_type tau) {
+  for (auto& p : d.parts) drift_soa(p->q, *p, n, tau);
+  d.exchange();
+  return d.parts[0]->last;
+}
+
+#ifdef NBODY_MPI
+// Adds the accelerations of the n local particles due to the "nj" particles of
+// a block of the ring, returns once the kernel is complete
+static void force_block_soa(queue& q, SoABuffers& b, int n, real_type* block,
+                            int nj) {
+  if (n == 0 || nj == 0) return;
+  buffer<real_type> jbuf(block, range<1>(4 * nj),
+                         {property::buffer::use_host_ptr()});
+  q.submit([&](handler& h) {
+    auto x = b.x.get_access<access::mode::read>(h);
+    auto y = b.y.get_access<access::mode::read>(h);
+    auto z = b.z.get_access<access::mode::read>(h);
+    auto ax = b.ax.get_access<access::mode::read_write>(h);
+    auto ay = b.ay.get_access<access::mode::read_write>(h);
+    auto az = b.az.get_access<access::mode::read_write>(h);
+    auto jp = jbuf.get_access<access::mode::read>(h);
+    h.parallel_for(range<1>(n), [=](id<1> i) {
+      const compute_type xi = x[i];
+      const compute_type yi = y[i];
+      const compute_type zi = z[i];
+      accum_type acc0 = ax[i];
+      accum_type acc1 = ay[i];
+      accum_type acc2 = az[i];
+      for (int j = 0; j < nj; j++) {
+        const compute_type dx = compute_type(jp[j]) - xi;
+        const compute_type dy = compute_type(jp[nj + j]) - yi;
+        const compute_type dz = compute_type(jp[2 * nj + j]) - zi;
+        const compute_type distanceSqr =
+            dx * dx + dy * dy + dz * dz + softeningSquared;
+        const compute_type distanceInv = 1.0 / sycl::sqrt(distanceSqr);
+        const compute_type s = G * compute_type(jp[3 * nj + j]) *
+                               distanceInv * distanceInv * distanceInv;
+        acc0 += dx * s;
+        acc1 += dy * s;
+        acc2 += dz * s;
+      }
+      ax[i] = acc0;
+      ay[i] = acc1;
+      az[i] = acc2;
+    });
+  });
+}
+
+// Direct sum over the ring: the local particles form the first block, and in
+// every round the current block is sent to the right neighbour and the next
+// one received from the left while the kernel works on the current one.
+// Returns once the accelerations are complete.
+static event ring_force(queue& q, SoABuffers& b, Ring& ring) {
+  const int n = ring.count(ring.rank);
+  {
+    auto x = b.x.get_access<access::mode::read>();
+    auto y = b.y.get_access<access::mode::read>();
+    auto z = b.z.get_access<access::mode::read>();
+    auto m = b.m.get_access<access::mode::read>();
+    real_type* blk = ring.blocks[0].data();
+    for (int i = 0; i < n; ++i) {
+      blk[i] = x[i];
+      blk[n + i] = y[i];
+      blk[2 * n + i] = z[i];
+      blk[3 * n + i] = m[i];
+    }
+  }
+  const int left = (ring.rank + ring.size - 1) % ring.size;
+  const int right = (ring.rank + 1) % ring.size;
+  for (int r = 0, cur = 0; r < ring.size; ++r, cur ^= 1) {
+    // the block of round r comes from rank - r
+    const int src = (ring.rank + ring.size - r) % ring.size;
+    const int next = (src + ring.size - 1) % ring.size;
+    MPI_Request req[2];
+    int nreq = 0;
+    if (r + 1 < ring.size) {
+      MPI_Irecv(ring.blocks[cur ^ 1].data(),
+                int(4 * ring.count(next) * sizeof(real_type)), MPI_BYTE, left,
+                r, MPI_COMM_WORLD, &req[nreq++]);
+      MPI_Isend(ring.blocks[cur].data(),
+                int(4 * ring.count(src) * sizeof(real_type)), MPI_BYTE, right,
+                r, MPI_COMM_WORLD, &req[nreq++]);
+    }
+    force_block_soa(q, b, n, ring.blocks[cur].data(), ring.count(src));
+    MPI_Waitall(nreq, req, MPI_STATUSES_IGNORE);
+  }
+  return event();
+}
+#endif
+
+// Calls the force computation of a step and keeps its kernels and the host
+// time of the call for the profile. Returns the first of the kernels.
+template <class Force>
+static event timed_force(StepEvents& ev, Force& force, double& gflops,
+                         int n) {
+  const std::size_t first = ev.forces.size();
+  auto t0 = std::chrono::steady_clock::now();
+  event e = force(gflops, &ev.forces);
+  auto t1 = std::chrono::steady_clock::now();
+  ev.forces.push_back(e);
+  ev.host_force += std::chrono::duration<double>(t1 - t0).count();
+  ev.evaluations += 1.;
+  ev.bytes += words_force * sizeof(real_type) * double(n);
+  return ev.forces[first];
+}
+
+// One step of a kick-drift-kick scheme, the coefficients are known at compile
+// time and the substeps are unrolled. "Arrays" are the SoA buffers, the USM
+// arrays or a device split.
+template <Integrator I, class Arrays, class Force>
+static StepEvents kdk_step(queue& q, Arrays& b, int n, compute_type dt,
+                           Force& force, double& gflops,
+                           buffer<accum_type>* ksum) {
+  using S = KDKScheme<I>;
+  StepEvents ev;
+  ev.first = kick_soa(q, b, n, S::kick[0] * dt, nullptr);
+  ev.updates.push_back(ev.first);
+  for (int k = 0; k < S::stages; ++k) {
+    ev.updates.push_back(drift_soa(q, b, n, S::drift[k] * dt));
+    timed_force(ev, force, gflops, n);
+    ev.last = kick_soa(q, b, n, S::kick[k + 1] * dt,
+                       k + 1 == S::stages ? ksum : nullptr);
+    ev.updates.push_back(ev.last);
+  }
+  ev.bytes += sizeof(real_type) * double(n) *
+              ((S::stages + 1) * words_kick + S::stages * words_drift);
+  gflops += 1e-9 * double(n) *
+            ((S::stages + 1) * flops_kick + S::stages * flops_drift +
+             (ksum ? flops_energy : 0.));
+  return ev;
+}
+
+// Accelerations and their time derivatives (jerks) for the Hermite scheme.
+// Unlike the other force kernels it overwrites a and j. With block time
+// steps only the "nactive" particles of the active list are updated.
+static event force_jerk_soa(queue& q, SoABuffers& b, HermiteBuffers& hb,
+                            int n, BlockBuffers* bb = nullptr,
+                            int nactive = 0) {
+  return q.submit([&](handler& h) {
+    auto x = b.x.get_access<access::mode::read>(h);
+    auto y = b.y.get_access<access::mode::read>(h);
+    auto z = b.z.get_access<access::mode::read>(h);
+    auto vx = b.vx.get_access<access::mode::read>(h);
+    auto vy = b.vy.get_access<access::mode::read>(h);
+    auto vz = b.vz.get_access<access::mode::read>(h);
+    auto m = b.m.get_access<access::mode::read>(h);
+    auto ax = b.ax.get_access<access::mode::discard_write>(h);
+    auto ay = b.ay.get_access<access::mode::discard_write>(h);
+    auto az = b.az.get_access<access::mode::discard_write>(h);
+    auto jx = hb.jx.get_access<access::mode::discard_write>(h);
+    auto jy = hb.jy.get_access<access::mode::discard_write>(h);
+    auto jz = hb.jz.get_access<access::mode::discard_write>(h);
+    auto jerk = [=](int i) {
+      const compute_type xi = x[i], yi = y[i], zi = z[i];
+      const compute_type vxi = vx[i], vyi = vy[i], vzi = vz[i];
+      accum_type acc0 = 0, acc1 = 0, acc2 = 0;
+      accum_type jrk0 = 0, jrk1 = 0, jrk2 = 0;
+      for (int j = 0; j < n; j++) {
+        const compute_type dx = compute_type(x[j]) - xi;     // 1flop
+        const compute_type dy = compute_type(y[j]) - yi;     // 1flop
+        const compute_type dz = compute_type(z[j]) - zi;     // 1flop
+        const compute_type dvx = compute_type(vx[j]) - vxi;  // 1flop
+        const compute_type dvy = compute_type(vy[j]) - vyi;  // 1flop
+        const compute_type dvz = compute_type(vz[j]) - vzi;  // 1flop
+
+        const compute_type distanceSqr =
+            dx * dx + dy * dy + dz * dz + softeningSquared;  // 6flops
+        const compute_type distanceInv =
+            1.0 / sycl::sqrt(distanceSqr);                   // 1div+1sqrt
+        const compute_type distanceInv2 = distanceInv * distanceInv;  // 1flop
+        const compute_type mr3 = G * compute_type(m[j]) * distanceInv * distanceInv2;  // 3flops
+        const compute_type rv =
+            3 * (dx * dvx + dy * dvy + dz * dvz) * distanceInv2;  // 7flops
+
+        acc0 += mr3 * dx;                 // 2flops
+        acc1 += mr3 * dy;                 // 2flops
+        acc2 += mr3 * dz;                 // 2flops
+        jrk0 += mr3 * (dvx - rv * dx);    // 4flops
+        jrk1 += mr3 * (dvy - rv * dy);    // 4flops
+        jrk2 += mr3 * (dvz - rv * dz);    // 4flops
+      }
+      ax[i] = acc0;
+      ay[i] = acc1;
+      az[i] = acc2;
+      jx[i] = jrk0;
+      jy[i] = jrk1;
+      jz[i] = jrk2;
+    };
+    if (bb) {
+      auto active = bb->active.get_access<access::mode::read>(h);
+      h.parallel_for(range<1>(nactive), [=](id<1> k) { jerk(active[k]); });
+    } else {
+      h.parallel_for(range<1>(n), [=](id<1> i) { jerk(i); });
+    }
+  });
+}
+
+// Hermite predictor: saves the state at the beginning of the step and
+// extrapolates positions and velocities to its end with a Taylor series
+static event predict_soa(queue& q, SoABuffers& b, HermiteBuffers& hb, int n,
+                         compute_type dt) {
+  return q.submit([&](handler& h) {
+    auto x = b.x.get_access<access::mode::read_write>(h);
+    auto y = b.y.get_access<access::mode::read_write>(h);
+    auto z = b.z.get_access<access::mode::read_write>(h);
+    auto vx = b.vx.get_access<access::mode::read_write>(h);
+    auto vy = b.vy.get_access<access::mode::read_write>(h);
+    auto vz = b.vz.get_access<access::mode::read_write>(h);
+    auto ax = b.ax.get_access<access::mode::read>(h);
+    auto ay = b.ay.get_access<access::mode::read>(h);
+    auto az = b.az.get_access<access::mode::read>(h);
+    auto jx = hb.jx.get_access<access::mode::read>(h);
+    auto jy = hb.jy.get_access<access::mode::read>(h);
+    auto jz = hb.jz.get_access<access::mode::read>(h);
+    auto x0 = hb.x0.get_access<access::mode::discard_write>(h);
+    auto y0 = hb.y0.get_access<access::mode::discard_write>(h);
+    auto z0 = hb.z0.get_access<access::mode::discard_write>(h);
+    auto vx0 = hb.vx0.get_access<access::mode::discard_write>(h);
+    auto vy0 = hb.vy0.get_access<access::mode::discard_write>(h);
+    auto vz0 = hb.vz0.get_access<access::mode::discard_write>(h);
+    auto ax0 = hb.ax0.get_access<access::mode::discard_write>(h);
+    auto ay0 = hb.ay0.get_access<access::mode::discard_write>(h);
+    auto az0 = hb.az0.get_access<access::mode::discard_write>(h);
+    auto jx0 = hb.jx0.get_access<access::mode::discard_write>(h);
+    auto jy0 = hb.jy0.get_access<access::mode::discard_write>(h);
+    auto jz0 = hb.jz0.get_access<access::mode::discard_write>(h);
+    const compute_type dt2 = dt / 2, dt6 = dt / 6;
+    h.parallel_for(range<1>(n), [=](id<1> i) {
+      x0[i] = x[i];
+      y0[i] = y[i];
+      z0[i] = z[i];
+      vx0[i] = vx[i];
+      vy0[i] = vy[i];
+      vz0[i] = vz[i];
+      ax0[i] = ax[i];
+      ay0[i] = ay[i];
+      az0[i] = az[i];
+      jx0[i] = jx[i];
+      jy0[i] = jy[i];
+      jz0[i] = jz[i];
+
+      x[i] += dt * (vx[i] + dt * (ax[i] * 0.5f + jx[i] * dt6));  // 7flops
+      y[i] += dt * (vy[i] + dt * (ay[i] * 0.5f + jy[i] * dt6));  // 7flops
+      z[i] += dt * (vz[i] + dt * (az[i] * 0.5f + jz[i] * dt6));  // 7flops
+
+      vx[i] += dt * (ax[i] + jx[i] * dt2);  // 4flops
+      vy[i] += dt * (ay[i] + jy[i] * dt2);  // 4flops
+      vz[i] += dt * (az[i] + jz[i] * dt2);  // 4flops
+    });
+  });
+}
+
+// Hermite corrector from the accelerations and jerks at both ends of the step
+// (Makino & Aarseth 1992). If "ksum" is given, the sum of m v^2 is reduced
+// into it on the fly.
+static event correct_soa(queue& q, SoABuffers& b, HermiteBuffers& hb, int n,
+                         compute_type dt, buffer<accum_type>* ksum) {
+  return q.submit([&](handler& h) {
+    auto x = b.x.get_access<access::mode::discard_write>(h);
+    auto y = b.y.get_access<access::mode::discard_write>(h);
+    auto z = b.z.get_access<access::mode::discard_write>(h);
+    auto vx = b.vx.get_access<access::mode::discard_write>(h);
+    auto vy = b.vy.get_access<access::mode::discard_write>(h);
+    auto vz = b.vz.get_access<access::mode::discard_write>(h);
+    auto ax = b.ax.get_access<access::mode::read>(h);
+    auto ay = b.ay.get_access<access::mode::read>(h);
+    auto az = b.az.get_access<access::mode::read>(h);
+    auto jx = hb.jx.get_access<access::mode::read>(h);
+    auto jy = hb.jy.get_access<access::mode::read>(h);
+    auto jz = hb.jz.get_access<access::mode::read>(h);
+    auto x0 = hb.x0.get_access<access::mode::read>(h);
+    auto y0 = hb.y0.get_access<access::mode::read>(h);
+    auto z0 = hb.z0.get_access<access::mode::read>(h);
+    auto vx0 = hb.vx0.get_access<access::mode::read>(h);
+    auto vy0 = hb.vy0.get_access<access::mode::read>(h);
+    auto vz0 = hb.vz0.get_access<access::mode::read>(h);
+    auto ax0 = hb.ax0.get_access<access::mode::read>(h);
+    auto ay0 = hb.ay0.get_access<access::mode::read>(h);
+    auto az0 = hb.az0.get_access<access::mode::read>(h);
+    auto jx0 = hb.jx0.get_access<access::mode::read>(h);
+    auto jy0 = hb.jy0.get_access<access::mode::read>(h);
+    auto jz0 = hb.jz0.get_access<access::mode::read>(h);
+    auto m = b.m.get_access<access::mode::read>(h);
+    const compute_type dt2 = dt / 2, dt12 = dt * dt / 12;
+    auto correct = [=](int i) {
+      const compute_type v1[3] = {
+          vx0[i] + dt2 * (compute_type(ax0[i]) + ax[i]) +
+              dt12 * (compute_type(jx0[i]) - jx[i]),
+          vy0[i] + dt2 * (compute_type(ay0[i]) + ay[i]) +
+              dt12 * (compute_type(jy0[i]) - jy[i]),
+          vz0[i] + dt2 * (compute_type(az0[i]) + az[i]) +
+              dt12 * (compute_type(jz0[i]) - jz[i])};  // 18flops
+      vx[i] = v1[0];
+      vy[i] = v1[1];
+      vz[i] = v1[2];
+
+      x[i] = x0[i] + dt2 * (vx0[i] + v1[0]) +
+             dt12 * (compute_type(ax0[i]) - ax[i]);  // 6flops
+      y[i] = y0[i] + dt2 * (vy0[i] + v1[1]) +
+             dt12 * (compute_type(ay0[i]) - ay[i]);  // 6flops
+      z[i] = z0[i] + dt2 * (vz0[i] + v1[2]) +
+             dt12 * (compute_type(az0[i]) - az[i]);  // 6flops
+
+      return kinetic_term(m[i], v1[0], v1[1], v1[2]);  // 7flops
+    };
+    if (ksum) {
+      auto sum = reduction(*ksum, h, sycl::plus<accum_type>(),
+                           {property::reduction::initialize_to_identity()});
+      h.parallel_for(range<1>(n), sum,
+                     [=](id<1> i, auto& e) { e += correct(i); });
+    } else {
+      h.parallel_for(range<1>(n), [=](id<1> i) { correct(i); });
+    }
+  });
+}
+
+// One step of the fourth order Hermite predictor-corrector
+static StepEvents hermite_step(queue& q, SoABuffers& b, HermiteBuffers& hb,
+                               int n, compute_type dt, double& gflops,
+                               buffer<accum_type>* ksum) {
+  StepEvents ev;
+  ev.first = predict_soa(q, b, hb, n, dt);
+  ev.forces.push_back(force_jerk_soa(q, b, hb, n));
+  ev.last = correct_soa(q, b, hb, n, dt, ksum);
+  ev.updates = {ev.first, ev.last};
+  ev.evaluations = 1.;
+  ev.bytes = sizeof(real_type) * double(n) *
+             (words_predict + words_hermite_force + words_correct);
+  const double nd = double(n);
+  gflops += 1e-9 * (flops_hermite_pair * nd * nd +
+                    (flops_predict + flops_correct +
+                     (ksum ? flops_energy : 0.)) * nd);
+  return ev;
+}
+
+// Smallest level whose step dt / 2^level does not exceed "step", at most
+// "levels"
+static inline int block_level(compute_type dt, compute_type step, int levels) {
+  if (!(step < dt)) return 0;
+  compute_type l = sycl::ceil(sycl::log2(dt / step));
+  return int(sycl::min(l, compute_type(levels)));
+}
+
+// Starts the block time steps from the accelerations and jerks of all the
+// particles: the current state becomes the state at the beginning of their
+// steps and the initial level is chosen from eta / 2 * |a| / |j|
+static event init_blocks_soa(queue& q, SoABuffers& b, HermiteBuffers& hb,
+                             BlockBuffers& bb, int n, compute_type dt, int levels,
+                             compute_type eta) {
+  return q.submit([&](handler& h) {
+    auto x = b.x.get_access<access::mode::read>(h);
+    auto y = b.y.get_access<access::mode::read>(h);
+    auto z = b.z.get_access<access::mode::read>(h);
+    auto vx = b.vx.get_access<access::mode::read>(h);
+    auto vy = b.vy.get_access<access::mode::read>(h);
+    auto vz = b.vz.get_access<access::mode::read>(h);
+    auto ax = b.ax.get_access<access::mode::read>(h);
+    auto ay = b.ay.get_access<access::mode::read>(h);
+    auto az = b.az.get_access<access::mode::read>(h);
+    auto jx = hb.jx.get_access<access::mode::read>(h);
+    auto jy = hb.jy.get_access<access::mode::read>(h);
+    auto jz = hb.jz.get_access<access::mode::read>(h);
+    auto x0 = hb.x0.get_access<access::mode::discard_write>(h);
+    auto y0 = hb.y0.get_access<access::mode::discard_write>(h);
+    auto z0 = hb.z0.get_access<access::mode::discard_write>(h);
+    auto vx0 = hb.vx0.get_access<access::mode::discard_write>(h);
+    auto vy0 = hb.vy0.get_access<access::mode::discard_write>(h);
+    auto vz0 = hb.vz0.get_access<access::mode::discard_write>(h);
+    auto ax0 = hb.ax0.get_access<access::mode::discard_write>(h);
+    auto ay0 = hb.ay0.get_access<access::mode::discard_write>(h);
+    auto az0 = hb.az0.get_access<access::mode::discard_write>(h);
+    auto jx0 = hb.jx0.get_access<access::mode::discard_write>(h);
+    auto jy0 = hb.jy0.get_access<access::mode::discard_write>(h);
+    auto jz0 = hb.jz0.get_access<access::mode::discard_write>(h);
+    auto level = bb.level.get_access<access::mode::discard_write>(h);
+    auto tick = bb.tick.get_access<access::mode::discard_write>(h);
+    h.parallel_for(range<1>(n), [=](id<1> i) {
+      x0[i] = x[i];
+      y0[i] = y[i];
+      z0[i] = z[i];
+      vx0[i] = vx[i];
+      vy0[i] = vy[i];
+      vz0[i] = vz[i];
+      ax0[i] = ax[i];
+      ay0[i] = ay[i];
+      az0[i] = az[i];
+      jx0[i] = jx[i];
+      jy0[i] = jy[i];
+      jz0[i] = jz[i];
+
+      const compute_type a1[3] = {ax[i], ay[i], az[i]};
+      const compute_type j1[3] = {jx[i], jy[i], jz[i]};
+      const compute_type a =
+          sycl::sqrt(a1[0] * a1[0] + a1[1] * a1[1] + a1[2] * a1[2]);
+      const compute_type j =
+          sycl::sqrt(j1[0] * j1[0] + j1[1] * j1[1] + j1[2] * j1[2]);
+      level[i] = block_level(dt, compute_type(0.5) * eta * a / j, levels);
+      tick[i] = 0;
+    });
+  });
+}
+
+// Finds the time of the next block, the earliest end of the steps of the
+// particles, and clears the active list
+static event schedule_blocks(queue& q, BlockBuffers& bb, int n, int levels) {
+  return q.submit([&](handler& h) {
+    auto level = bb.level.get_access<access::mode::read>(h);
+    auto tick = bb.tick.get_access<access::mode::read>(h);
+    auto count = bb.count.get_access<access::mode::discard_write>(h);
+    auto tmin = reduction(bb.tnext, h, sycl::minimum<int>(),
+                          {property::reduction::initialize_to_identity()});
+    h.parallel_for(range<1>(n), tmin, [=](id<1> i, auto& t) {
+      if (i == 0) count[0] = 0;
+      t.combine(tick[i] + (1 << (levels - level[i])));
+    });
+  });
+}
+
+// Predicts the positions and velocities of all the particles at the time of
+// the block "tn" and appends the particles whose step ends there to the
+// active list
+static event predict_blocks(queue& q, SoABuffers& b, HermiteBuffers& hb,
+                            BlockBuffers& bb, int n, int tn, compute_type dtick,
+                            int levels) {
+  return q.submit([&](handler& h) {
+    auto x = b.x.get_access<access::mode::discard_write>(h);
+    auto y = b.y.get_access<access::mode::discard_write>(h);
+    auto z = b.z.get_access<access::mode::discard_write>(h);
+    auto vx = b.vx.get_access<access::mode::discard_write>(h);
+    auto vy = b.vy.get_access<access::mode::discard_write>(h);
+    auto vz = b.vz.get_access<access::mode::discard_write>(h);
+    auto x0 = hb.x0.get_access<access::mode::read>(h);
+    auto y0 = hb.y0.get_access<access::mode::read>(h);
+    auto z0 = hb.z0.get_access<access::mode::read>(h);
+    auto vx0 = hb.vx0.get_access<access::mode::read>(h);
+    auto vy0 = hb.vy0.get_access<access::mode::read>(h);
+    auto vz0 = hb.vz0.get_access<access::mode::read>(h);
+    auto ax0 = hb.ax0.get_access<access::mode::read>(h);
+    auto ay0 = hb.ay0.get_access<access::mode::read>(h);
+    auto az0 = hb.az0.get_access<access::mode::read>(h);
+    auto jx0 = hb.jx0.get_access<access::mode::read>(h);
+    auto jy0 = hb.jy0.get_access<access::mode::read>(h);
+    auto jz0 = hb.jz0.get_access<access::mode::read>(h);
+    auto level = bb.level.get_access<access::mode::read>(h);
+    auto tick = bb.tick.get_access<access::mode::read>(h);
+    auto active = bb.active.get_access<access::mode::write>(h);
+    auto count = bb.count.get_access<access::mode::read_write>(h);
+    h.parallel_for(range<1>(n), [=](id<1> i) {
+      const compute_type dt = (tn - tick[i]) * dtick;
+      const compute_type dt2 = dt / 2, dt6 = dt / 6;
+      x[i] = x0[i] + dt * (vx0[i] + dt * (ax0[i] * 0.5f + jx0[i] * dt6));
+      y[i] = y0[i] + dt * (vy0[i] + dt * (ay0[i] * 0.5f + jy0[i] * dt6));
+      z[i] = z0[i] + dt * (vz0[i] + dt * (az0[i] * 0.5f + jz0[i] * dt6));
+
+      vx[i] = vx0[i] + dt * (ax0[i] + jx0[i] * dt2);
+      vy[i] = vy0[i] + dt * (ay0[i] + jy0[i] * dt2);
+      vz[i] = vz0[i] + dt * (az0[i] + jz0[i] * dt2);
+
+      if (tick[i] + (1 << (levels - level[i])) == tn) {
+        atomic_ref<int, memory_order::relaxed, memory_scope::device,
+                   access::address_space::global_space>
+            c(count[0]);
+        active[c.fetch_add(1)] = i;
+      }
+    });
+  });
+}
+
+// Hermite corrector of the active particles, followed by the choice of their
+// next level with the criterion of Aarseth (2003) from the accelerations and
+// their first three derivatives at the end of the step. The step may always
+// shrink to a higher level, but it only doubles, one level at a time, when
+// the new time is a multiple of the longer step, so that the blocks stay
+// synchronized. If "ksum" is given, the sum of m v^2 over the active
+// particles is reduced into it on the fly.
+static event correct_blocks(queue& q, SoABuffers& b, HermiteBuffers& hb,
+                            BlockBuffers& bb, int nactive, compute_type dtick,
+                            int levels, compute_type eta,
+                            buffer<accum_type>* ksum) {
+  return q.submit([&](handler& h) {
+    auto x = b.x.get_access<access::mode::write>(h);
+    auto y = b.y.get_access<access::mode::write>(h);
+    auto z = b.z.get_access<access::mode::write>(h);
+    auto vx = b.vx.get_access<access::mode::write>(h);
+    auto vy = b.vy.get_access<access::mode::write>(h);
+    auto vz = b.vz.get_access<access::mode::write>(h);
+    auto ax = b.ax.get_access<access::mode::read>(h);
+    auto ay = b.ay.get_access<access::mode::read>(h);
+    auto az = b.az.get_access<access::mode::read>(h);
+    auto jx = hb.jx.get_access<access::mode::read>(h);
+    auto jy = hb.jy.get_access<access::mode::read>(h);
+    auto jz = hb.jz.get_access<access::mode::read>(h);
+    auto x0 = hb.x0.get_access<access::mode::read_write>(h);
+    auto y0 = hb.y0.get_access<access::mode::read_write>(h);
+    auto z0 = hb.z0.get_access<access::mode::read_write>(h);
+    auto vx0 = hb.vx0.get_access<access::mode::read_write>(h);
+    auto vy0 = hb.vy0.get_access<access::mode::read_write>(h);
+    auto vz0 = hb.vz0.get_access<access::mode::read_write>(h);
+    auto ax0 = hb.ax0.get_access<access::mode::read_write>(h);
+    auto ay0 = hb.ay0.get_access<access::mode::read_write>(h);
+    auto az0 = hb.az0.get_access<access::mode::read_write>(h);
+    auto jx0 = hb.jx0.get_access<access::mode::read_write>(h);
+    auto jy0 = hb.jy0.get_access<access::mode::read_write>(h);
+    auto jz0 = hb.jz0.get_access<access::mode::read_write>(h);
+    auto m = b.m.get_access<access::mode::read>(h);
+    auto level = bb.level.get_access<access::mode::read_write>(h);
+    auto tick = bb.tick.get_access<access::mode::read_write>(h);
+    auto active = bb.active.get_access<access::mode::read>(h);
+    const int end = 1 << levels;
+    auto correct = [=](int i) {
+      const int steps = 1 << (levels - level[i]);
+      const compute_type dt = steps * dtick;
+      const compute_type dt2 = dt / 2, dt12 = dt * dt / 12;
+      const compute_type v0[3] = {vx0[i], vy0[i], vz0[i]};
+      const compute_type a0[3] = {ax0[i], ay0[i], az0[i]};
+      const compute_type j0[3] = {jx0[i], jy0[i], jz0[i]};
+      const compute_type a1[3] = {ax[i], ay[i], az[i]};
+      const compute_type j1[3] = {jx[i], jy[i], jz[i]};
+
+      compute_type v1[3];
+      for (int d = 0; d < 3; ++d)
+        v1[d] = v0[d] + dt2 * (a0[d] + a1[d]) +
+                dt12 * (j0[d] - j1[d]);  // 6flops
+      x0[i] = x[i] = x0[i] + dt2 * (v0[0] + v1[0]) +
+                     dt12 * (a0[0] - a1[0]);  // 6flops
+      y0[i] = y[i] = y0[i] + dt2 * (v0[1] + v1[1]) +
+                     dt12 * (a0[1] - a1[1]);  // 6flops
+      z0[i] = z[i] = z0[i] + dt2 * (v0[2] + v1[2]) +
+                     dt12 * (a0[2] - a1[2]);  // 6flops
+      vx0[i] = vx[i] = v1[0];
+      vy0[i] = vy[i] = v1[1];
+      vz0[i] = vz[i] = v1[2];
+      ax0[i] = a1[0];
+      ay0[i] = a1[1];
+      az0[i] = a1[2];
+      jx0[i] = j1[0];
+      jy0[i] = j1[1];
+      jz0[i] = j1[2];
+
+      // second and third derivative of the acceleration from the Hermite
+      // interpolation over the step
+      const compute_type idt = 1 / dt;
+      compute_type a2[3], a3[3];
+      for (int d = 0; d < 3; ++d) {
+        const compute_type da = a0[d] - a1[d];
+        a3[d] = (12 * da + 6 * dt * (j0[d] + j1[d])) * idt * idt *
+                idt;  // 9flops
+        a2[d] = (-6 * da - dt * (4 * j0[d] + 2 * j1[d])) * idt * idt +
+                dt * a3[d];  // 11flops
+      }
+      const compute_type na1 =
+          sycl::sqrt(a1[0] * a1[0] + a1[1] * a1[1] + a1[2] * a1[2]);
+      const compute_type nj1 =
+          sycl::sqrt(j1[0] * j1[0] + j1[1] * j1[1] + j1[2] * j1[2]);
+      const compute_type na2 =
+          sycl::sqrt(a2[0] * a2[0] + a2[1] * a2[1] + a2[2] * a2[2]);
+      const compute_type na3 =
+          sycl::sqrt(a3[0] * a3[0] + a3[1] * a3[1] + a3[2] * a3[2]);
+      const compute_type step = sycl::sqrt(
+          eta * (na1 * na2 + nj1 * nj1) / (nj1 * na3 + na2 * na2));  // 8flops
+
+      const int t = tick[i] + steps;
+      int l = block_level(end * dtick, step, levels);
+      if (l < level[i]) l = t % (2 * steps) == 0 ? level[i] - 1 : level[i];
+      level[i] = l;
+      // all the particles are synchronized at the end of the step
+      tick[i] = t == end ? 0 : t;
+
+      return kinetic_term(m[i], v1[0], v1[1], v1[2]);  // 7flops
+    };
+    if (ksum) {
+      auto sum = reduction(*ksum, h, sycl::plus<accum_type>(),
+                           {property::reduction::initialize_to_identity()});
+      h.parallel_for(range<1>(nactive), sum,
+                     [=](id<1> k, auto& e) { e += correct(active[k]); });
+    } else {
+      h.parallel_for(range<1>(nactive), [=](id<1> k) { correct(active[k]); });
+    }
+  });
+}
+
+// One step of the Hermite scheme with block time steps: the blocks within the
+// step are processed in time order, and each of them only corrects and
+// recomputes the forces of its active particles. The time of the next block
+// and the size of the active list are read back on the host to size the
+// kernels. "substeps" and "evaluations" count the blocks and the force
+// evaluations.
+static StepEvents block_step(queue& q, SoABuffers& b, HermiteBuffers& hb,
+                             BlockBuffers& bb, int n, compute_type dt, int levels,
+                             compute_type eta, double& gflops,
+                             buffer<accum_type>* ksum, double& substeps,
+                             double& evaluations) {
+  StepEvents ev;
+  const int end = 1 << levels;
+  const compute_type dtick = dt / end;
+  int tn = 0;
+  while (tn < end) {
+    event e = schedule_blocks(q, bb, n, levels);
+    if (tn == 0) ev.first = e;
+    ev.updates.push_back(e);
+    {
+      auto t = bb.tnext.get_access<access::mode::read>();
+      tn = t[0];
+    }
+    ev.updates.push_back(predict_blocks(q, b, hb, bb, n, tn, dtick, levels));
+    int nactive;
+    {
+      auto c = bb.count.get_access<access::mode::read>();
+      nactive = c[0];
+    }
+    ev.forces.push_back(force_jerk_soa(q, b, hb, n, &bb, nactive));
+    ev.last = correct_blocks(q, b, hb, bb, nactive, dtick, levels, eta,
+                             tn == end ? ksum : nullptr);
+    ev.updates.push_back(ev.last);
+    ev.evaluations += double(nactive) / n;
+    ev.bytes += sizeof(real_type) *
+                (words_predict * double(n) +
+                 (words_hermite_force + words_correct) * double(nactive));
+    gflops += 1e-9 * (flops_hermite_pair * double(nactive) * double(n) +
+                      flops_predict * double(n) +
+                      flops_block_correct * double(nactive));
+    substeps += 1;
+    evaluations += nactive;
+  }
+  if (ksum) gflops += 1e-9 * flops_energy * double(n);
+  return ev;
+}
+
+// Calls f while host accessors keep the SoA arrays up to date on the host,
+// with read_write access when f modifies them
+template <access::mode Mode = access::mode::read, class F>
+static void on_host(SoABuffers& b, F f) {
+  [[maybe_unused]] auto x = b.x.get_access<Mode>();
+  [[maybe_unused]] auto y = b.y.get_access<Mode>();
+  [[maybe_unused]] auto z = b.z.get_access<Mode>();
+  [[maybe_unused]] auto vx = b.vx.get_access<Mode>();
+  [[maybe_unused]] auto vy = b.vy.get_access<Mode>();
+  [[maybe_unused]] auto vz = b.vz.get_access<Mode>();
+  [[maybe_unused]] auto ax = b.ax.get_access<Mode>();
+  [[maybe_unused]] auto ay = b.ay.get_access<Mode>();
+  [[maybe_unused]] auto az = b.az.get_access<Mode>();
+  [[maybe_unused]] auto m = b.m.get_access<Mode>();
+  f();
+}
+
+// Sorts all the arrays of the particles along the space-filling curve with the
+// parallel radix sort of the tree code. order[k] follows the original index of
+// the particle in slot k.
+static void sort_particles(ParticleSoA& ps, Curve curve,
+                           std::vector<int>& order) {
+  const int n = ps.npart;
+  if (order.empty()) {
+    order.resize(n);
+    for (int i = 0; i < n; ++i) order[i] = i;
+  }
+  std::vector<uint64_t> keys;
+  curve_keys(ps.pos_x, ps.pos_y, ps.pos_z, n, curve == Curve::Hilbert, keys);
+  std::vector<int> perm(n);
+  for (int i = 0; i < n; ++i) perm[i] = i;
+  radix_sort(keys, perm);
+
+  std::vector<real_type> tmp(n);
+  for (int f = 0; f < ParticleSoA::nfields; ++f) {
+    real_type* a = ps.data + f * ps.stride;
+#pragma omp parallel for
+    for (int k = 0; k < n; ++k) tmp[k] = a[perm[k]];
+    std::copy(tmp.begin(), tmp.end(), a);
+  }
+  std::vector<int> sorted(n);
+#pragma omp parallel for
+  for (int k = 0; k < n; ++k) sorted[k] = order[perm[k]];
+  order.swap(sorted);
+}
+
+// Copies sorted particles back to their original order
+static void unsort(const ParticleSoA& ps, const std::vector<int>& order,
+                   ParticleSoA& out) {
+  const int n = ps.npart;
+  if (out.npart != n) out.resize(n);
+  for (int f = 0; f < ParticleSoA::nfields; ++f) {
+    const real_type* a = ps.data + f * ps.stride;
+    real_type* b = out.data + f * out.stride;
+#pragma omp parallel for
+    for (int k = 0; k < n; ++k) b[order[k]] = a[k];
   }
 }
 
 void GSimulation ::start() {
-  real_type dt = get_tstep();
+  if (get_ensemble() > 0) {
+    run_ensemble();
+    return;
+  }
+  _step0 = 0;
+  if (!get_restart().empty()) {
+    // the particles, the time step and the step count come from the file
+    input_file.open(get_restart());
+    const CheckpointHeader& h = input_file.header();
+    set_npart(int(h.npart));
+    set_tstep(compute_type(h.tstep));
+    _step0 = int(h.step);
+    if (_step0 >= get_nsteps())
+      throw std::runtime_error(get_restart() + " is already at step " +
+                               std::to_string(_step0) + " of " +
+                               std::to_string(get_nsteps()));
+    std::cout << "# Restarting from " << get_restart() << " at step "
+              << _step0 << std::endl;
+  } else if (!get_initial_conditions().empty()) {
+    // initial conditions have the format of a checkpoint at step 0
+    input_file.open(get_initial_conditions());
+    set_npart(int(input_file.header().npart));
+    std::cout << "# Initial conditions from " << get_initial_conditions()
+              << std::endl;
+  }
+  compute_type dt = get_tstep();
   int n = get_npart();
-  real_type* energy = new real_type[n];
-  for (int i = 0; i < n; i++) energy[i] = 0.f;
   // allocate particles
   particles = new Particle[n];
 
-  init_pos();
-  init_vel();
-  init_acc();
-  init_mass();
+  if (!input_file.is_open()) {
+    if (get_model() == Model::Cube) {
+      init_pos();
+      init_vel();
+      init_mass();
+    } else {
+      sample_model(get_model(), particles, n, get_seed());
+    }
+    init_acc();
+  }
+
+#ifdef NBODY_MPI
+  // every rank integrates a contiguous slice of the particles, moved to the
+  // front of the array, and the direct sum runs over the ring of the ranks
+  if (input_file.is_open()) {
+    ParticleSoA view;
+    input_file.attach(view);
+    view.store(particles);
+    input_file.close();
+    // the force kernels add onto the accelerations
+    init_acc();
+  }
+  Ring ring(n);
+  std::copy(particles + ring.first(),
+            particles + ring.first() + ring.count(ring.rank), particles);
+  n = ring.count(ring.rank);
+  std::cout << "# Ring of " << ring.size << " ranks, particles per rank:";
+  for (int r = 0; r < ring.size; ++r) std::cout << " " << ring.count(r);
+  std::cout << std::endl;
+  if (get_solver() != Solver::Direct) {
+    std::cout << "# The MPI ring uses the direct solver" << std::endl;
+    set_solver(Solver::Direct);
+  }
+  if (get_integrator() == Integrator::Hermite4 || get_block_levels() > 0) {
+    std::cout << "# The MPI ring requires a kick-drift-kick integrator, "
+                 "using leapfrog"
+              << std::endl;
+    set_integrator(Integrator::Leapfrog);
+    set_block_levels(0);
+  }
+  if (!get_checkpoint().empty() || !get_snapshot().empty()) {
+    std::cout << "# The MPI ring does not write checkpoints or snapshots"
+              << std::endl;
+    set_checkpoint("", 0);
+    set_snapshot("", 1, get_snapshot_fields());
+  }
+  // the blocks are exchanged through the host every step
+  set_layout(Layout::SoA);
+  set_force_kernel(ForceKernel::Flat);
+  set_memory(Memory::Buffer);
+  set_split(Split::None);
+  set_pipelined(false);
+#endif
 
   print_header();
 
-  _totTime = 0.;
+  if (!get_snapshot().empty())
+    snapshots.open(get_snapshot(), get_snapshot_fields(),
+                   get_snapshot_error());
 
-  const float softeningSquared = 1e-3f;
-  // prevents explosion in the case the particles are really close to each other
-  const float G = 6.67259e-11f;
+  _totTime = 0.;
 
-  double nd = double(n);
-  double gflops = 1e-9 * ((11. + 18.) * nd * nd + nd * 19.);
-  double av = 0.0, dev = 0.0;
-  int nf = 0;
   auto R = range<1>(n);
+
+  // the tree code and the FMM need the positions on the host every step
+  if (get_pipelined() && get_solver() != Solver::Direct) {
+    std::cout << "# The pipelined mode requires the direct solver, "
+                 "synchronizing every step"
+              << std::endl;
+    set_pipelined(false);
+  }
   // Create a queue to the selected device and enabled asynchronous exception
-  // handling for that queue
-  queue q(default_selector{}, exception_handler);
-  // Create SYCL buffer for the Particle array of size "n"
-  buffer pbuf(particles, R, {cl::sycl::property::buffer::use_host_ptr()});
-  // Create SYCL buffer for the ener array
-  buffer ebuf(energy, R, {cl::sycl::property::buffer::use_host_ptr()});
+  // handling for that queue. The profile times the kernels with their
+  // profiling information.
+  queue q(default_selector{}, exception_handler,
+          {property::queue::enable_profiling()});
+  _device = q.get_device().get_info<info::device::name>();
+  _units = q.get_device().get_info<info::device::max_compute_units>();
+
+  if (get_block_levels() > 0) {
+    if (get_solver() != Solver::Direct) {
+      std::cout << "# Block time steps require the direct solver, "
+                   "using a shared time step"
+                << std::endl;
+      set_block_levels(0);
+    } else {
+      if (get_integrator() != Integrator::Hermite4)
+        std::cout << "# Block time steps use the Hermite integrator"
+                  << std::endl;
+      set_integrator(Integrator::Hermite4);
+    }
+  }
+  // the host reads the size of every block back
+  if (get_pipelined() && get_block_levels() > 0) {
+    std::cout << "# The pipelined mode does not support block time steps, "
+                 "synchronizing every step"
+              << std::endl;
+    set_pipelined(false);
+  }
+
+  // the jerk of the Hermite scheme is only computed by the direct sum
+  if (get_integrator() == Integrator::Hermite4 &&
+      get_solver() != Solver::Direct) {
+    std::cout << "# The Hermite integrator requires the direct solver, "
+                 "using leapfrog"
+              << std::endl;
+    set_integrator(Integrator::Leapfrog);
+  }
+
+  // the tree code, the FMM and the integrators other than Euler work on the
+  // SoA arrays
+  if (get_solver() != Solver::Direct || get_integrator() != Integrator::Euler)
+    set_layout(Layout::SoA);
+
+  if (get_solver() == Solver::Direct &&
+      get_force_kernel() == ForceKernel::Tiled) {
+    // the tiled kernel stages the SoA position and mass arrays
+    set_layout(Layout::SoA);
+    int maxwg = q.get_device().get_info<info::device::max_work_group_size>();
+    if (get_wgsize() > maxwg) {
+      std::cout << "# Work-group size " << get_wgsize()
+                << " exceeds the device limit, using " << maxwg << std::endl;
+      set_wgsize(maxwg);
+    }
+    // x, y, z and mass of one tile have to fit into local memory
+    int maxtile = q.get_device().get_info<info::device::local_mem_size>() /
+                  (4 * sizeof(real_type));
+    if (get_tilesize() > maxtile) {
+      std::cout << "# Tile size " << get_tilesize()
+                << " exceeds the local memory, using " << maxtile << std::endl;
+      set_tilesize(maxtile);
+    }
+  }
+
+  if (get_solver() == Solver::Direct &&
+      (get_force_kernel() == ForceKernel::Specialized ||
+       get_force_kernel() == ForceKernel::Blocked))
+    set_layout(Layout::SoA);
+
+  if (get_solver() == Solver::Direct &&
+      get_force_kernel() == ForceKernel::Symmetric) {
+    set_layout(Layout::SoA);
+    if (!q.get_device().is_cpu())
+      std::cout << "# The symmetric kernel is written for CPU devices"
+                << std::endl;
+  }
+
+  // devices or sub-devices sharing the particles
+  std::vector<device> devices;
+  if (get_split() != Split::None) {
+    if (get_solver() != Solver::Direct ||
+        get_integrator() == Integrator::Hermite4) {
+      std::cout << "# The device split requires the direct solver and a "
+                   "kick-drift-kick integrator"
+                << std::endl;
+    } else if (get_split() == Split::Numa) {
+      try {
+        devices = q.get_device().create_sub_devices<
+            info::partition_property::partition_by_affinity_domain>(
+            info::partition_affinity_domain::numa);
+      } catch (const sycl::exception&) {
+        std::cout << "# The device has no NUMA sub-devices" << std::endl;
+      }
+    } else {
+      devices = device::get_devices(
+          q.get_device().get_info<info::device::device_type>());
+    }
+    if (devices.size() < 2) {
+      devices.clear();
+    } else {
+      // the positions are exchanged through the host every step
+      set_memory(Memory::Device);
+      set_pipelined(false);
+      std::cout << "# Splitting the particles over " << devices.size()
+                << " queues" << std::endl;
+    }
+  }
+
+  if (get_memory() != Memory::Buffer) {
+    // the USM path covers the direct solver with the Euler and kick-drift-kick
+    // schemes
+    if (get_solver() != Solver::Direct ||
+        get_integrator() == Integrator::Hermite4) {
+      std::cout << "# USM requires the direct solver and a kick-drift-kick "
+                   "integrator, using buffers"
+                << std::endl;
+      set_memory(Memory::Buffer);
+    } else {
+      set_layout(Layout::SoA);
+    }
+  }
+  // the re-sort permutes the SoA buffers on the host, but neither the state
+  // of the Hermite scheme nor the USM arrays
+  if (get_sort_freq() > 0) {
+    if (get_integrator() == Integrator::Hermite4 ||
+        get_memory() != Memory::Buffer) {
+      std::cout << "# Re-sorting requires buffers and a kick-drift-kick "
+                   "integrator, keeping the initial order"
+                << std::endl;
+      set_sort(0, get_curve());
+    } else {
+      set_layout(Layout::SoA);
+    }
+  }
+  // the per-thread accumulators of the symmetric kernel are buffers
+  if (get_force_kernel() == ForceKernel::Symmetric &&
+      (get_memory() != Memory::Buffer || !devices.empty())) {
+    std::cout << "# The symmetric kernel requires buffers, using the flat "
+                 "kernel"
+              << std::endl;
+    set_force_kernel(ForceKernel::Flat);
+  }
+  if ((get_force_kernel() == ForceKernel::Specialized ||
+       get_force_kernel() == ForceKernel::Blocked) &&
+      (get_memory() != Memory::Buffer || !devices.empty())) {
+    std::cout << "# The "
+              << (get_force_kernel() == ForceKernel::Blocked ? "register-blocked"
+                                                             : "specialised")
+              << " kernel requires buffers, using the flat kernel"
+              << std::endl;
+    set_force_kernel(ForceKernel::Flat);
+  }
+
+  if (get_layout() == Layout::SoA) {
+    if (input_file.is_open()) {
+      // the arrays are used in place from the mapped file, and the buffers
+      // hand its pages to the device without another copy
+      input_file.attach(particles_soa);
+      // The force kernels add onto the accelerations, which are recomputed
+      // from the positions: the ones of the file would be counted twice.
+      // The mapping is private, the file itself is left untouched.
+      for (real_type* a : {particles_soa.acc_x, particles_soa.acc_y,
+                           particles_soa.acc_z})
+        std::fill(a, a + n, real_type(0));
+    } else {
+      particles_soa.resize(n);
+      particles_soa.load(particles);
+    }
+    // direct solver on USM arrays or a device split
+    auto run_usm = [&](auto& u) {
+      auto force = [&](double& gflops, std::vector<event>* = nullptr) {
+        gflops += 1e-9 * flops_pair * double(n) * double(n);
+        if (get_force_kernel() == ForceKernel::Tiled)
+          return force_tiled_soa(q, u, n, get_wgsize(), get_tilesize());
+        return force_soa(q, u, n);
+      };
+      if (get_integrator() != Integrator::Euler) {
+        double gflops = 0.;
+        force(gflops).wait_and_throw();
+      }
+
+      auto step = [&](double& gflops, buffer<accum_type>* ksum) {
+        switch (get_integrator()) {
+          case Integrator::Leapfrog:
+            return kdk_step<Integrator::Leapfrog>(q, u, n, dt, force, gflops,
+                                                  ksum);
+          case Integrator::Yoshida4:
+            return kdk_step<Integrator::Yoshida4>(q, u, n, dt, force, gflops,
+                                                  ksum);
+          default:
+            break;
+        }
+        StepEvents ev;
+        ev.first = timed_force(ev, force, gflops, n);
+        ev.last = update_soa(q, u, n, dt, ksum);
+        ev.updates.push_back(ev.last);
+        ev.bytes += words_euler * sizeof(real_type) * double(n);
+        gflops += 1e-9 * flops_euler * double(n);
+        return ev;
+      };
+      auto output = [&](int s) {
+        u.store(particles_soa);
+        if (snapshot_due(s)) snapshots.submit(particles_soa, s, s * double(dt));
+        if (checkpoint_due(s))
+          Checkpoint::write(get_checkpoint(), particles_soa, s, dt);
+      };
+      if (get_pipelined())
+        run_pipelined(step, output);
+      else
+        run(step, output);
+      u.store(particles_soa);
+    };
+    if (!devices.empty()) {
+      DeviceSplit split(devices, particles_soa);
+      std::cout << "# Particles per queue:";
+      for (auto& p : split.parts) std::cout << " " << p->end - p->begin;
+      std::cout << std::endl;
+      run_usm(split);
+    } else if (get_memory() != Memory::Buffer) {
+      USMArrays u(q, get_memory(), particles_soa);
+      run_usm(u);
+    } else {
+      SoABuffers b(particles_soa, R);
+      // one slice of accumulators per compute unit for the symmetric kernel,
+      // as many as fit in the largest allocation of the device
+      int nthreads = q.get_device().get_info<info::device::max_compute_units>();
+      std::unique_ptr<buffer<accum_type>> scratch;
+      if (get_force_kernel() == ForceKernel::Symmetric) {
+        const std::size_t slice = 3 * std::size_t(n) * sizeof(accum_type);
+        const std::size_t fit =
+            std::size_t(
+                q.get_device().get_info<info::device::max_mem_alloc_size>()) /
+            slice;
+        if (fit == 0) {
+          std::cout << "# The accumulators of the symmetric kernel do not fit "
+                       "on the device, using the flat kernel"
+                    << std::endl;
+          set_force_kernel(ForceKernel::Flat);
+        } else {
+          if (fit < std::size_t(nthreads)) {
+            nthreads = int(fit);
+            std::cout << "# The symmetric kernel runs " << nthreads
+                      << " work-items, as many slices as fit on the device"
+                      << std::endl;
+          }
+          scratch.reset(new buffer<accum_type>(
+              range<1>(3 * std::size_t(n) * std::size_t(nthreads))));
+        }
+      }
+
+      // G m in the precision of the specialised kernel, folded again after
+      // every re-sort of the particles
+      std::unique_ptr<buffer<float>> gm32;
+      std::unique_ptr<buffer<double>> gm64;
+      if (get_force_kernel() == ForceKernel::Specialized) {
+        if (get_kernel_precision() == KernelPrecision::Double)
+          gm64.reset(new buffer<double>(R));
+        else
+          gm32.reset(new buffer<float>(R));
+      }
+      auto fold = [&] {
+        if (gm32) fold_masses(q, b, *gm32, n);
+        if (gm64) fold_masses(q, b, *gm64, n);
+      };
+      auto specialized = [&](buffer<real_type>& ax, buffer<real_type>& ay,
+                             buffer<real_type>& az) {
+        if (gm64)
+          return force_specialized_soa(q, b, *gm64, ax, ay, az, n,
+                                       get_softening(), get_rsqrt());
+        return force_specialized_soa(q, b, *gm32, ax, ay, az, n,
+                                     get_softening(), get_rsqrt());
+      };
+      if (gm32 || gm64) {
+        fold();
+        // accuracy of the variant on the initial particles
+        buffer<real_type> ex(R), ey(R), ez(R);
+        q.submit([&](handler& h) {
+          auto x = ex.get_access<access::mode::discard_write>(h);
+          auto y = ey.get_access<access::mode::discard_write>(h);
+          auto z = ez.get_access<access::mode::discard_write>(h);
+          h.parallel_for(R, [=](id<1> i) {
+            x[i] = 0.;
+            y[i] = 0.;
+            z[i] = 0.;
+          });
+        });
+        specialized(ex, ey, ez);
+        const int nsample = std::min(n, 1024);
+        _force_rms = force_error(b, ex, ey, ez, n, nsample, get_softening(),
+                                 &_force_max);
+        std::cout << "# Specialised kernel " << kernel_variant()
+                  << ": relative error rms " << _force_rms << ", max "
+                  << _force_max << " over " << nsample << " particles"
+                  << std::endl;
+      }
+
+      // submits the force computation and adds its flops to "gflops",
+      // solvers running on the host return once the accelerations are
+      // complete. Kernels before the returned one go to "kernels".
+      auto force = [&](double& gflops, std::vector<event>* kernels = nullptr) {
+        if (get_solver() == Solver::BarnesHut) {
+          {
+            auto x = b.x.get_access<access::mode::read>();
+            auto y = b.y.get_access<access::mode::read>();
+            auto z = b.z.get_access<access::mode::read>();
+            auto m = b.m.get_access<access::mode::read>();
+            bh.build(x.get_pointer(), y.get_pointer(), z.get_pointer(),
+                     m.get_pointer(), n);
+          }
+          gflops += 1e-9 * bh.accelerations(q, b.ax, b.ay, b.az);
+          return event();
+        } else if (get_solver() == Solver::Cutoff) {
+          {
+            auto x = b.x.get_access<access::mode::read>();
+            auto y = b.y.get_access<access::mode::read>();
+            auto z = b.z.get_access<access::mode::read>();
+            auto m = b.m.get_access<access::mode::read>();
+            cells.build(x.get_pointer(), y.get_pointer(), z.get_pointer(),
+                        m.get_pointer(), n);
+          }
+          gflops += 1e-9 * cells.accelerations(q, b.ax, b.ay, b.az);
+          return event();
+        } else if (get_solver() == Solver::FMM ||
+                   get_solver() == Solver::PM) {
+          // the FMM and the PM solver run on the host threads
+          auto x = b.x.get_access<access::mode::read>();
+          auto y = b.y.get_access<access::mode::read>();
+          auto z = b.z.get_access<access::mode::read>();
+          auto m = b.m.get_access<access::mode::read>();
+          auto ax = b.ax.get_access<access::mode::read_write>();
+          auto ay = b.ay.get_access<access::mode::read_write>();
+          auto az = b.az.get_access<access::mode::read_write>();
+          if (get_solver() == Solver::FMM)
+            gflops += 1e-9 * fmm.accelerations(
+                                 x.get_pointer(), y.get_pointer(),
+                                 z.get_pointer(), m.get_pointer(),
+                                 ax.get_pointer(), ay.get_pointer(),
+                                 az.get_pointer(), n);
+          else
+            gflops += 1e-9 * pm.accelerations(x.get_pointer(), y.get_pointer(),
+                                              z.get_pointer(), m.get_pointer(),
+                                              ax.get_pointer(), ay.get_pointer(),
+                                              az.get_pointer(), n);
+          return event();
+        }
+#ifdef NBODY_MPI
+        gflops += 1e-9 * flops_pair * double(n) * double(ring.total());
+        return ring_force(q, b, ring);
+#endif
+        if (scratch) {
+          gflops += 1e-9 * (flops_symmetric_pair * 0.5 * double(n) *
+                                double(n - 1) +
+                            (flops_symmetric_sum * nthreads +
+                             flops_symmetric_scale) *
+                                double(n));
+          return force_symmetric_soa(q, b, *scratch, n, nthreads,
+                                     get_tilesize(), kernels);
+        }
+        if (gm32 || gm64) {
+          gflops += 1e-9 * flops_specialized_pair * double(n) * double(n);
+          return specialized(b.ax, b.ay, b.az);
+        }
+        gflops += 1e-9 * flops_pair * double(n) * double(n);
+        if (get_force_kernel() == ForceKernel::Tiled)
+          return force_tiled_soa(q, b, n, get_wgsize(), get_tilesize());
+        if (get_force_kernel() == ForceKernel::Blocked)
+          return force_blocked_soa(q, b, n, get_iblock());
+        return force_soa(q, b, n);
+      };
+
+      std::unique_ptr<HermiteBuffers> hb;
+      std::unique_ptr<BlockBuffers> bb;
+      if (get_integrator() == Integrator::Hermite4) {
+        hb.reset(new HermiteBuffers(R));
+        force_jerk_soa(q, b, *hb, n).wait_and_throw();
+        if (get_block_levels() > 0) {
+          bb.reset(new BlockBuffers(R));
+          init_blocks_soa(q, b, *hb, *bb, n, dt, get_block_levels(), get_eta())
+              .wait_and_throw();
+        }
+      } else if (get_integrator() != Integrator::Euler) {
+        // the kick-drift-kick schemes start from the accelerations at t = 0
+        double gflops = 0.;
+        force(gflops).wait_and_throw();
+      }
+
+      auto step = [&](double& gflops, buffer<accum_type>* ksum) {
+        switch (get_integrator()) {
+          case Integrator::Leapfrog:
+            return kdk_step<Integrator::Leapfrog>(q, b, n, dt, force, gflops,
+                                                  ksum);
+          case Integrator::Yoshida4:
+            return kdk_step<Integrator::Yoshida4>(q, b, n, dt, force, gflops,
+                                                  ksum);
+          case Integrator::Hermite4:
+            if (bb)
+              return block_step(q, b, *hb, *bb, n, dt, get_block_levels(),
+                                get_eta(), gflops, ksum, _substeps,
+                                _evaluations);
+            return hermite_step(q, b, *hb, n, dt, gflops, ksum);
+          default:
+            break;
+        }
+        StepEvents ev;
+        ev.first = timed_force(ev, force, gflops, n);
+        ev.last = update_soa(q, b, n, dt, ksum);
+        ev.updates.push_back(ev.last);
+        ev.bytes += words_euler * sizeof(real_type) * double(n);
+        gflops += 1e-9 * flops_euler * double(n);
+        return ev;
+      };
+      // the snapshots and checkpoints keep the original order of the
+      // particles
+      ParticleSoA unsorted;
+      auto output = [&](int s) {
+        on_host(b, [&] {
+          const ParticleSoA* ps = &particles_soa;
+          if (!_order.empty() && (snapshot_due(s) || checkpoint_due(s))) {
+            unsort(particles_soa, _order, unsorted);
+            ps = &unsorted;
+          }
+          if (snapshot_due(s)) snapshots.submit(*ps, s, s * double(dt));
+          if (checkpoint_due(s))
+            Checkpoint::write(get_checkpoint(), *ps, s, dt);
+        });
+        if (sort_due(s)) {
+          auto t0 = std::chrono::system_clock::now();
+          on_host<access::mode::read_write>(b, [&] {
+            sort_particles(particles_soa, get_curve(), _order);
+          });
+          auto t1 = std::chrono::system_clock::now();
+          const double t =
+              (static_cast<std::chrono::duration<double>>(t1 - t0)).count();
+          _sorttime += t;
+          _sorts++;
+          // the folded masses follow the new order
+          fold();
+          std::cout << "# Sorted along the "
+                    << (get_curve() == Curve::Hilbert ? "Hilbert" : "Morton")
+                    << " curve in " << t << " s" << std::endl;
+        }
+      };
+      if (get_pipelined())
+        run_pipelined(step, output);
+      else
+        run(step, output);
+    }
+    if (!_order.empty()) {
+      ParticleSoA unsorted;
+      unsort(particles_soa, _order, unsorted);
+      unsorted.store(particles);
+    } else {
+      particles_soa.store(particles);
+    }
+  } else {
+    if (input_file.is_open()) {
+      ParticleSoA view;
+      input_file.attach(view);
+      view.store(particles);
+      // the force kernel adds onto the accelerations
+      init_acc();
+    }
+    // Create SYCL buffer for the Particle array of size "n"
+    buffer pbuf(particles, R, {cl::sycl::property::buffer::use_host_ptr()});
+
+    auto step = [&](double& gflops, buffer<accum_type>* ksum) {
+      StepEvents ev;
+      ev.first = force_aos(q, pbuf, n);
+      ev.last = update_aos(q, pbuf, n, dt, ksum);
+      ev.forces.push_back(ev.first);
+      ev.updates.push_back(ev.last);
+      ev.evaluations = 1.;
+      ev.bytes = (words_force + words_euler) * sizeof(real_type) * double(n);
+      gflops += 1e-9 * (flops_pair * double(n) * double(n) +
+                        flops_euler * double(n));
+      return ev;
+    };
+    auto output = [&](int s) {
+      [[maybe_unused]] auto p = pbuf.get_access<access::mode::read>();
+      if (particles_soa.npart != n) particles_soa.resize(n);
+      particles_soa.load(particles);
+      if (snapshot_due(s)) snapshots.submit(particles_soa, s, s * double(dt));
+      if (checkpoint_due(s))
+        Checkpoint::write(get_checkpoint(), particles_soa, s, dt);
+    };
+    if (get_pipelined())
+      run_pipelined(step, output);
+    else
+      run(step, output);
+  }
+  input_file.close();
+}
+
+// time from the start of the first to the end of the last command
+static double profiled_seconds(const event& first, const event& last) {
+  auto start = first.get_profiling_info<info::event_profiling::command_start>();
+  auto end = last.get_profiling_info<info::event_profiling::command_end>();
+  return 1e-9 * double(end - start);
+}
+
+// device time of the given kernels, 0 if the events carry no profiling
+// information, as those of the solvers running on the host
+static double device_seconds(const std::vector<event>& events) {
+  double t = 0.;
+  try {
+    for (const event& e : events) t += profiled_seconds(e, e);
+  } catch (const sycl::exception&) {
+    return 0.;
+  }
+  return t;
+}
+
+// Profile of a sampled step. The bytes are summed over the MPI ranks, "n" is
+// the number of particles of all the ranks.
+static Profile::Sample profile_sample(const StepEvents& ev, int s,
+                                      double seconds, double gflops,
+                                      double reduction, int n) {
+  Profile::Sample p;
+  p.step = s;
+  p.seconds = seconds;
+  p.gflops = gflops;
+  p.force = device_seconds(ev.forces);
+  if (p.force == 0.) p.force = ev.host_force;
+  p.update = device_seconds(ev.updates);
+  p.reduction = reduction;
+  p.interactions = ev.evaluations * double(n) * double(n);
+  p.bytes = global_sum(ev.bytes);
+  return p;
+}
+
+// Runs the time step loop. "step" submits the kernels advancing the particles
+// by one time step, reduces m v^2 into the given buffer, adds the flops of the
+// step to "gflops" and returns the events of its first and last kernel.
+// "output" writes the snapshots and checkpoints due after the given step and
+// re-sorts the particles when due. A restarted simulation continues after the
+// step of its checkpoint.
+template <class Step, class Output>
+void GSimulation ::run(Step step, Output output) {
+  // Create SYCL buffer for the sum of m v^2, reduced by the update kernel
+  buffer<accum_type> kbuf(range<1>(1));
+  double gflops;
+  double totgflops = 0.0;
+  reset_stats();
 
   auto t0 = std::chrono::system_clock::now();
   int nsteps = get_nsteps();
-  for (int s = 1; s <= nsteps; ++s) {
+  for (int s = _step0 + 1; s <= nsteps; ++s) {
     auto ts0 = std::chrono::system_clock::now();
-    q.submit([&](handler& h) {
-       auto p = pbuf.get_access<access::mode::read_write>(h);
-       h.parallel_for(R, [=](id<1> i) {
-         real_type acc0 = p[i].acc[0];
-         real_type acc1 = p[i].acc[1];
-         real_type acc2 = p[i].acc[2];
-         for (int j = 0; j < n; j++) {
-           real_type dx, dy, dz;
-           real_type distanceSqr = 0.0;
-           real_type distanceInv = 0.0;
-
-           dx = p[j].pos[0] - p[i].pos[0];  // 1flop
-           dy = p[j].pos[1] - p[i].pos[1];  // 1flop
-           dz = p[j].pos[2] - p[i].pos[2];  // 1flop
-
-           distanceSqr =
-               dx * dx + dy * dy + dz * dz + softeningSquared;  // 6flops
-           distanceInv = 1.0 / sycl::sqrt(distanceSqr);         // 1div+1sqrt
-
-           acc0 += dx * G * p[j].mass * distanceInv * distanceInv *
-                   distanceInv;  // 6flops
-           acc1 += dy * G * p[j].mass * distanceInv * distanceInv *
-                   distanceInv;  // 6flops
-           acc2 += dz * G * p[j].mass * distanceInv * distanceInv *
-                   distanceInv;  // 6flops
-         }
-         p[i].acc[0] = acc0;
-         p[i].acc[1] = acc1;
-         p[i].acc[2] = acc2;
-       });
-     })
-        .wait_and_throw();
-    q.submit([&](handler& h) {
-       auto p = pbuf.get_access<access::mode::read_write>(h);
-       auto e = ebuf.get_access<access::mode::read_write>(h);
-       h.parallel_for(R, [=](id<1> i) {
-         p[i].vel[0] += p[i].acc[0] * dt;  // 2flops
-         p[i].vel[1] += p[i].acc[1] * dt;  // 2flops
-         p[i].vel[2] += p[i].acc[2] * dt;  // 2flops
-
-         p[i].pos[0] += p[i].vel[0] * dt;  // 2flops
-         p[i].pos[1] += p[i].vel[1] * dt;  // 2flops
-         p[i].pos[2] += p[i].vel[2] * dt;  // 2flops
-
-         p[i].acc[0] = 0.;
-         p[i].acc[1] = 0.;
-         p[i].acc[2] = 0.;
-
-         e[i] = p[i].mass *
-                (p[i].vel[0] * p[i].vel[0] + p[i].vel[1] * p[i].vel[1] +
-                 p[i].vel[2] * p[i].vel[2]);  // 7flops
-       });
-     })
-        .wait_and_throw();
-    q.submit([&](handler& h) {
-        auto e = ebuf.get_access<access::mode::read_write>(h);
-        h.single_task([=]() {
-        for(int i = 1; i < n; i++)
-                e[0] += e[i];
-        });
-    })
-    	.wait_and_throw();	
-    auto a = ebuf.get_access<access::mode::read_write>();
-    _kenergy = 0.5 * a[0];
-    a[0] = 0;
-
+    gflops = 0.;
+    StepEvents ev = step(gflops, &kbuf);
+    ev.last.wait_and_throw();
+    auto tr0 = std::chrono::system_clock::now();
+    _kenergy = kinetic_energy(kbuf);
+    auto tr1 = std::chrono::system_clock::now();
+    gflops = global_sum(gflops);
+    totgflops += gflops;
     auto ts1 = std::chrono::system_clock::now();
     double elapsedseconds =
         (static_cast<std::chrono::duration<double>>(ts1 - ts0)).count();
     if (!(s % get_sfreq())) {
-      nf += 1;
-      std::cout << " " << std::left << std::setw(8) << s << std::left
-                << std::setprecision(5) << std::setw(8) << s * get_tstep()
-                << std::left << std::setprecision(5) << std::setw(12)
-                << _kenergy << std::left << std::setprecision(5)
-                << std::setw(12) << elapsedseconds << std::left
-                << std::setprecision(5) << std::setw(12)
-                << gflops * get_sfreq() / elapsedseconds << std::endl;
-      if (nf > 2) {
-        av += gflops * get_sfreq() / elapsedseconds;
-        dev += gflops * get_sfreq() * gflops * get_sfreq() /
-               (elapsedseconds * elapsedseconds);
-      }
+      print_step(s, elapsedseconds, gflops);
+      const double reduction =
+          (static_cast<std::chrono::duration<double>>(tr1 - tr0)).count();
+      _profile.add(profile_sample(ev, s, elapsedseconds, gflops, reduction,
+                                  get_npart()));
+    }
+    if (checkpoint_due(s) || snapshot_due(s) || sort_due(s)) output(s);
+
+  }  // end of the time step loop
+  auto t1 = std::chrono::system_clock::now();
+  _totTime = (static_cast<std::chrono::duration<double>>(t1 - t0)).count();
+  _totFlops = totgflops;
+  // waits for the snapshots still being written
+  snapshots.close();
+
+  print_summary();
+}
+
+// Pipelined time step loop: the kernels of all the steps are submitted
+// without waiting, and the runtime orders them through the buffer
+// dependencies. m v^2 is only reduced on the sampling steps, alternately into
+// one of two buffers, and the host reads a sample back when the next one is
+// submitted, so it never waits for the step the device is working on. The
+// time of a step is taken from the profiling information of its kernels.
+template <class Step, class Output>
+void GSimulation ::run_pipelined(Step step, Output output) {
+  buffer<accum_type> kbuf[2] = {buffer<accum_type>(range<1>(1)),
+                                buffer<accum_type>(range<1>(1))};
+  struct Sample {
+    int step;
+    int slot;
+    StepEvents ev;
+    double gflops;
+  } pending;
+  bool has_pending = false;
+  int slot = 0;
+  double gflops;
+  double totgflops = 0.0;
+  reset_stats();
+
+  auto report = [&](const Sample& p) {
+    auto tr0 = std::chrono::system_clock::now();
+    _kenergy = kinetic_energy(kbuf[p.slot]);
+    auto tr1 = std::chrono::system_clock::now();
+    const double seconds = profiled_seconds(p.ev.first, p.ev.last);
+    print_step(p.step, seconds, p.gflops);
+    const double reduction =
+        (static_cast<std::chrono::duration<double>>(tr1 - tr0)).count();
+    _profile.add(profile_sample(p.ev, p.step, seconds, p.gflops, reduction,
+                                get_npart()));
+  };
+
+  auto t0 = std::chrono::system_clock::now();
+  int nsteps = get_nsteps();
+  for (int s = _step0 + 1; s <= nsteps; ++s) {
+    gflops = 0.;
+    const bool sample = !(s % get_sfreq());
+    StepEvents ev = step(gflops, sample ? &kbuf[slot] : nullptr);
+    totgflops += gflops;
+    if (sample) {
+      if (has_pending) report(pending);
+      pending = {s, slot, ev, gflops};
+      has_pending = true;
+      slot ^= 1;
+    }
+    // waits for the step
+    if (checkpoint_due(s) || snapshot_due(s) || sort_due(s)) output(s);
+  }  // end of the time step loop
+  if (has_pending) report(pending);
+  auto t1 = std::chrono::system_clock::now();
+  _totTime = (static_cast<std::chrono::duration<double>>(t1 - t0)).count();
+  _totFlops = totgflops;
+  // waits for the snapshots still being written
+  snapshots.close();
+
+  print_summary();
+}
+
+// Ensemble mode: "_systems" independent systems of get_npart() particles,
+// system k generated from the seed plus k, packed together and advanced by
+// the same kernels. The kinetic energy printed is the mean over the systems.
+// With MPI the systems are dealt out to the ranks in turn.
+void GSimulation ::run_ensemble() {
+  int rank = 0, size = 1;
+#ifdef NBODY_MPI
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &size);
+#endif
+  if (get_ensemble() < size)
+    throw std::runtime_error("the ensemble needs a system per MPI rank");
+  if (!get_restart().empty() || !get_initial_conditions().empty() ||
+      !get_checkpoint().empty() || !get_snapshot().empty()) {
+    std::cout << "# The ensemble mode generates its systems and writes no "
+                 "checkpoints or snapshots"
+              << std::endl;
+    set_restart("");
+    set_initial_conditions("");
+    set_checkpoint("", 0);
+    set_snapshot("", 1, get_snapshot_fields());
+  }
+  if (get_solver() != Solver::Direct) {
+    std::cout << "# The ensemble mode uses the direct solver" << std::endl;
+    set_solver(Solver::Direct);
+  }
+  if (get_integrator() == Integrator::Hermite4 || get_block_levels() > 0) {
+    std::cout << "# The ensemble mode requires the Euler or a "
+                 "kick-drift-kick integrator, using leapfrog"
+              << std::endl;
+    set_integrator(Integrator::Leapfrog);
+    set_block_levels(0);
+  }
+
+  const int n = get_npart();
+  const uint64_t seed = get_seed();
+  particles = new Particle[n];
+  Ensemble ensemble;
+  ensemble.set_work_group_size(get_wgsize());
+  for (int k = rank; k < get_ensemble(); k += size) {
+    set_seed(seed + k);
+    if (get_model() == Model::Cube) {
+      init_pos();
+      init_vel();
+      init_mass();
+    } else {
+      sample_model(get_model(), particles, n, get_seed());
     }
+    init_acc();
+    ensemble.add(particles, n);
+  }
+  set_seed(seed);
+  ensemble.start();
+
+  std::cout << "# Ensemble of " << get_ensemble() << " systems" << std::endl;
+  print_header();
+
+  queue q(default_selector{}, exception_handler,
+          {property::queue::enable_profiling()});
+  _device = q.get_device().get_info<info::device::name>();
+  _units = q.get_device().get_info<info::device::max_compute_units>();
 
+  // the kick-drift-kick schemes start from the accelerations at t = 0
+  if (get_integrator() != Integrator::Euler)
+    ensemble.force(q).wait_and_throw();
+
+  const compute_type dt = get_tstep();
+  const double pairs = global_sum(ensemble.get_pairs());
+  double gflops;
+  double totgflops = 0.0;
+  reset_stats();
+
+  auto t0 = std::chrono::system_clock::now();
+  for (int s = 1; s <= get_nsteps(); ++s) {
+    auto ts0 = std::chrono::system_clock::now();
+    gflops = 0.;
+    ensemble.step(q, get_integrator(), dt, gflops).wait_and_throw();
+    gflops = global_sum(gflops);
+    totgflops += gflops;
+    if (s % get_sfreq()) continue;
+
+    auto tr0 = std::chrono::system_clock::now();
+    double e = 0.;
+    for (accum_type ek : ensemble.kinetic_energies(q)) e += ek;
+    _kenergy = global_sum(e) / get_ensemble();
+    auto tr1 = std::chrono::system_clock::now();
+    double elapsedseconds =
+        (static_cast<std::chrono::duration<double>>(tr1 - ts0)).count();
+    print_step(s, elapsedseconds, gflops);
+
+    Profile::Sample p;
+    p.step = s;
+    p.seconds = elapsedseconds;
+    p.gflops = gflops;
+    p.force = device_seconds(ensemble.get_force_events());
+    p.update = device_seconds(ensemble.get_update_events());
+    p.reduction =
+        (static_cast<std::chrono::duration<double>>(tr1 - tr0)).count();
+    p.interactions = ensemble.get_evaluations() * pairs;
+    p.bytes = global_sum(ensemble.get_bytes());
+    _profile.add(p);
   }  // end of the time step loop
   auto t1 = std::chrono::system_clock::now();
   _totTime = (static_cast<std::chrono::duration<double>>(t1 - t0)).count();
-  _totFlops = gflops * get_nsteps();
+  _totFlops = totgflops;
 
-  av /= (double)(nf - 2);
-  dev = sqrt(dev / (double)(nf - 2) - av * av);
+  print_summary();
+}
+
+// a checkpoint is written every _ckfreq steps and after the last one
+bool GSimulation ::checkpoint_due(int s) const {
+  if (get_checkpoint().empty()) return false;
+  return (get_checkpoint_freq() > 0 && !(s % get_checkpoint_freq())) ||
+         s == get_nsteps();
+}
+
+bool GSimulation ::snapshot_due(int s) const {
+  return snapshots.is_open() && !(s % get_snapshot_freq());
+}
+
+bool GSimulation ::sort_due(int s) const {
+  return get_sort_freq() > 0 && !(s % get_sort_freq()) && s < get_nsteps();
+}
+
+void GSimulation ::reset_stats() {
+  _substeps = 0.;
+  _evaluations = 0.;
+  _sorts = 0;
+  _sorttime = 0.;
+  _profile.clear();
+}
+
+void GSimulation ::print_step(int s, double elapsedseconds, double gflops) {
+  std::cout << " " << std::left << std::setw(8) << s << std::left
+            << std::setprecision(5) << std::setw(8) << s * get_tstep()
+            << std::left << std::setprecision(5) << std::setw(12) << _kenergy
+            << std::left << std::setprecision(5) << std::setw(12)
+            << elapsedseconds << std::left << std::setprecision(5)
+            << std::setw(12) << gflops / elapsedseconds << std::endl;
+}
+
+void GSimulation ::print_summary() {
+  // statistics over all the sampled steps, the first ones include the JIT
+  // compilation of the kernels and show up in the upper percentiles
+  const Profile::Stats perf = _profile.gflops();
 
   int nthreads = 1;
+#ifdef _OPENMP
+  nthreads = omp_get_max_threads();
+#endif
 
   std::cout << std::endl;
+  std::cout << "# Device             : " << _device << std::endl;
+  std::cout << "# Compute Units      : " << _units << std::endl;
   std::cout << "# Number Threads     : " << nthreads << std::endl;
   std::cout << "# Total Time (s)     : " << _totTime << std::endl;
-  std::cout << "# Average Performance : " << av << " +- " << dev << std::endl;
+  std::cout << "# Average Performance : " << perf.mean << " +- " << perf.stddev
+            << std::endl;
+  std::cout << "# Performance p50/p90/p99 : " << perf.p50 << " / " << perf.p90
+            << " / " << perf.p99 << std::endl;
+  std::cout << "# Kernel Time (s)    : force " << _profile.total(&Profile::Sample::force)
+            << ", update " << _profile.total(&Profile::Sample::update)
+            << ", reduction " << _profile.total(&Profile::Sample::reduction)
+            << std::endl;
+  if (get_block_levels() > 0) {
+    const int nsteps = get_nsteps() - _step0;
+    std::cout << "# Blocks per Step    : " << _substeps / nsteps << std::endl;
+    std::cout << "# Forces per Particle and Step : "
+              << _evaluations / (double(get_npart()) * nsteps) << std::endl;
+  }
+  if (get_ensemble() > 0) {
+    std::cout << "# Systems            : " << get_ensemble() << std::endl;
+    std::cout << "# Throughput (systems*steps/s) : "
+              << get_ensemble() * double(get_nsteps()) / _totTime
+              << std::endl;
+  }
+  if (_sorts > 0) {
+    std::cout << "# Sorts              : " << _sorts << std::endl;
+    std::cout << "# Sort Time (s)      : " << _sorttime << std::endl;
+  }
+  if (!get_snapshot().empty()) {
+    std::cout << "# Snapshots          : " << snapshots.get_written()
+              << std::endl;
+    std::cout << "# Snapshot Stall (s) : " << snapshots.get_stall_time()
+              << std::endl;
+    if (get_snapshot_error() > 0.)
+      std::cout << "# Compression Ratio  : " << snapshots.get_ratio()
+                << std::endl;
+  }
+  if (!get_report().empty()) write_report(nthreads);
   std::cout << "===============================" << std::endl;
 }
 
+// Writes the timings of the sampled steps, only from the first MPI rank
+void GSimulation ::write_report(int nthreads) {
+  // every MPI rank knows the particles of all the ranks, and the ensemble
+  // those of one system
+  const int npart = get_npart();
+  int rank = 0;
+#ifdef NBODY_MPI
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+#endif
+  if (rank) return;
+  auto quoted = [](const std::string& v) {
+    std::string q = "\"";
+    for (char c : v) {
+      if (c == '"' || c == '\\') q += '\\';
+      q += c;
+    }
+    return q + "\"";
+  };
+  auto number = [](double v) {
+    std::ostringstream s;
+    s << std::setprecision(8) << v;
+    return s.str();
+  };
+  std::vector<std::pair<std::string, std::string>> run = {
+      {"npart", std::to_string(npart)},
+      {"nsteps", std::to_string(get_nsteps())},
+      {"dt", number(get_tstep())},
+      {"precision", quoted(std::string(precision_name(sizeof(real_type))) +
+                           "/" + precision_name(sizeof(accum_type)))},
+      {"device", quoted(_device)},
+      {"compute_units", std::to_string(_units)},
+      {"threads", std::to_string(nthreads)},
+      {"sample_frequency", std::to_string(get_sfreq())}};
+  if (_force_max >= 0.) {
+    run.push_back({"kernel", quoted("specialized/" + kernel_variant())});
+    run.push_back({"force_rms_error", number(_force_rms)});
+    run.push_back({"force_max_error", number(_force_max)});
+  }
+  if (get_ensemble() > 0) {
+    run.push_back({"systems", std::to_string(get_ensemble())});
+    run.push_back({"systems_steps_per_s",
+                   number(get_ensemble() * double(get_nsteps()) / _totTime)});
+  }
+  _profile.write(get_report(), run, _totTime);
+  std::cout << "# Report             : " << get_report() << std::endl;
+}
+
+// softening, inverse square root and arithmetic of the specialised kernel
+std::string GSimulation ::kernel_variant() const {
+  std::string v =
+      get_softening() == Softening::Spline ? "spline/" : "plummer/";
+  v += get_rsqrt() == Rsqrt::Native   ? "native/"
+       : get_rsqrt() == Rsqrt::Newton ? "newton/"
+                                      : "exact/";
+  return v + (get_kernel_precision() == KernelPrecision::Double ? "double"
+                                                                : "float");
+}
+
 void GSimulation ::print_header() {
   std::cout << " nPart = " << get_npart() << "; "
             << "nSteps = " << get_nsteps() << "; "
             << "dt = " << get_tstep() << std::endl;
+  std::cout << " Precision: " << precision_name(sizeof(real_type))
+            << " storage, " << precision_name(sizeof(accum_type))
+            << " accumulation" << std::endl;
 
   std::cout << "------------------------------------------------" << std::endl;
   std::cout << " " << std::left << std::setw(8) << "s" << std::left
@@ -235,4 +2799,4 @@ void GSimulation ::print_header() {
   std::cout << "------------------------------------------------" << std::endl;
 }
 
-GSimulation ::~GSimulation() { delete particles; }
+GSimulation ::~GSimulation() { delete[] particles; }
@@ -22,7 +22,43 @@
 #include <string>
 
 #include <CL/sycl.hpp>
+#include "BarnesHut.hpp"
+#include "CellList.hpp"
+#include "Checkpoint.hpp"
+#include "Ensemble.hpp"
+#include "FMM.hpp"
+#include "Integrator.hpp"
+#include "Interaction.hpp"
+#include "Models.hpp"
 #include "Particle.hpp"
+#include "ParticleSoA.hpp"
+#include "PM.hpp"
+#include "Profile.hpp"
+#include "Snapshot.hpp"
+#include "constants.hpp"
+
+// memory layout used for the particles inside the time step loop
+enum class Layout { AoS, SoA };
+
+// algorithm computing the gravitational accelerations
+enum class Solver { Direct, BarnesHut, FMM, PM, Cutoff };
+
+// implementation of the pairwise force kernel of the direct solver
+enum class ForceKernel { Flat, Tiled, Symmetric, Specialized, Blocked };
+
+// arithmetic of the specialised force kernels
+enum class KernelPrecision { Float, Double };
+
+// memory holding the SoA arrays on the device: SYCL buffers or a USM
+// allocation of the given kind
+enum class Memory { Buffer, Device, Shared, Host };
+
+// queues sharing the direct force computation: one, the NUMA sub-devices of
+// the device, or all the devices of its type
+enum class Split { None, Numa, Devices };
+
+// space-filling curve along which the particles are re-sorted
+enum class Curve { Morton, Hilbert };
 
 class GSimulation {
  public:
@@ -32,22 +68,134 @@ class GSimulation {
   void init();
   void set_number_of_particles(int N);
   void set_number_of_steps(int N);
+  void set_layout(Layout l) { _layout = l; }
+  void set_pipelined(bool p) { _pipelined = p; }
+  void set_integrator(Integrator i) { _integrator = i; }
+  void set_block_levels(int levels) { _blocklevels = levels; }
+  void set_eta(compute_type eta) { _eta = eta; }
+  // writes a checkpoint to "path" every "every" steps and after the last one
+  void set_checkpoint(const std::string &path, int every) {
+    _checkpoint = path;
+    _ckfreq = every;
+  }
+  // distribution and seed of the generated initial conditions
+  void set_model(Model model) { _model = model; }
+  void set_seed(uint64_t seed) { _seed = seed; }
+  // continues the simulation from a checkpoint
+  void set_restart(const std::string &path) { _restart = path; }
+  // reads the particles from a file written by Checkpoint::convert_csv
+  void set_initial_conditions(const std::string &path) { _ic = path; }
+  // writes the given fields (SnapshotWriter::Field) to "path" every "every"
+  // steps on a background thread
+  void set_snapshot(const std::string &path, int every, unsigned fields) {
+    _snapshot = path;
+    _snapfreq = every;
+    _snapfields = fields;
+  }
+  // compresses the snapshots with the given relative error bound, 0 for
+  // uncompressed snapshots
+  void set_snapshot_error(double error) { _snaperror = error; }
+  void set_solver(Solver s) { _solver = s; }
+  void set_theta(compute_type theta) { bh.set_theta(theta); }
+  void set_leaf_size(int n) {
+    bh.set_leaf_size(n);
+    fmm.set_leaf_size(n);
+  }
+  void set_fmm_order(int p) { fmm.set_order(p); }
+  void set_pm_grid(int n) { pm.set_grid(n); }
+  void set_pm_box(double l) { pm.set_box(l); }
+  void set_cutoff(compute_type rc) { cells.set_cutoff(rc); }
+  void set_force_kernel(ForceKernel k) { _kernel = k; }
+  // variant of the specialised force kernel
+  void set_softening(Softening s) { _softening = s; }
+  void set_rsqrt(Rsqrt r) { _rsqrt = r; }
+  void set_kernel_precision(KernelPrecision p) { _kprecision = p; }
+  // i-particles per work-item of the register-blocked kernel: 2, 4 or 8
+  void set_iblock(int b) { _iblock = b; }
+  void set_memory(Memory m) { _memory = m; }
+  void set_split(Split s) { _split = s; }
+  // re-sorts the particles along the curve every "every" steps, never if 0
+  void set_sort(int every, Curve c) {
+    _sortfreq = every;
+    _curve = c;
+  }
+  // writes the timings of the sampled steps to "path" as JSON, or as CSV if
+  // its name ends with ".csv"
+  void set_report(const std::string &path) { _report = path; }
+  // integrates "systems" independent systems of the given number of
+  // particles together, each from its own seed, never if 0
+  void set_ensemble(int systems) { _systems = systems; }
+  void set_work_group_size(int wg) { set_wgsize(wg); }
+  void set_tile_size(int tile) { set_tilesize(tile); }
   void start();
 
  private:
   Particle *particles;
+  ParticleSoA particles_soa;
+  BarnesHut bh;
+  FMM fmm;
+  PM pm;
+  CellList cells;
 
   int _npart;        // number of particles
   int _nsteps;       // number of integration steps
-  real_type _tstep;  // time step of the simulation
+  compute_type _tstep;  // time step of the simulation
 
   int _sfreq;  // sample frequency
 
-  real_type _kenergy;  // kinetic energy
+  Layout _layout;   // Array-of-Structures or Structure-of-Arrays
+  bool _pipelined;  // submit the steps without waiting for the device
+
+  Integrator _integrator;  // time integration scheme
+  int _blocklevels;        // block time steps down to _tstep / 2^_blocklevels
+  compute_type _eta;       // accuracy parameter of the time step criterion
+
+  Solver _solver;       // direct sum, tree code or fast multipole method
+  ForceKernel _kernel;  // force kernel of the direct solver
+  Softening _softening;         // softening of the specialised kernel
+  Rsqrt _rsqrt;                 // its inverse square root
+  KernelPrecision _kprecision;  // and its arithmetic
+  int _iblock;                  // i-particles per work-item, blocked kernel
+  double _force_rms;  // rms relative error of the specialised kernel
+  double _force_max;  // and its maximum, negative if not measured
+  Memory _memory;       // buffers or USM
+  Split _split;         // queues of the direct solver
+  int _sortfreq;        // steps between two re-sorts of the particles
+  Curve _curve;         // curve of the re-sorts
+  int _systems;         // systems of the ensemble mode, none if 0
+  std::vector<int> _order;  // original index of each particle once sorted
+  int _sorts;               // number of re-sorts
+  double _sorttime;         // time spent in the re-sorts
+  int _wgsize;          // work-group size of the tiled force kernel
+  int _tilesize;        // j-particles staged in local memory per tile
+
+  accum_type _kenergy;  // kinetic energy
+
+  std::string _checkpoint;  // checkpoint file, none if empty
+  int _ckfreq;              // steps between two checkpoints
+  std::string _restart;     // checkpoint to restart from, none if empty
+  std::string _ic;          // initial conditions, random if empty
+  Model _model;             // generated initial conditions
+  uint64_t _seed;           // seed of the random numbers
+  int _step0;               // number of steps done before the start
+  Checkpoint input_file;    // mapped checkpoint or initial conditions
+  std::string _snapshot;    // snapshot file, none if empty
+  int _snapfreq;            // steps between two snapshots
+  unsigned _snapfields;     // fields written to the snapshots
+  double _snaperror;        // error bound of compressed snapshots
+  SnapshotWriter snapshots;
 
   double _totTime;   // total time of the simulation
   double _totFlops;  // total number of flops
 
+  double _substeps;     // blocks of the block time steps
+  double _evaluations;  // force evaluations of the block time steps
+
+  Profile _profile;     // timings of the sampled steps
+  std::string _report;  // report of the timings, none if empty
+  std::string _device;  // name of the device running the kernels
+  int _units;           // its compute units
+
   void init_pos();
   void init_vel();
   void init_acc();
@@ -56,8 +204,8 @@ class GSimulation {
   inline void set_npart(const int &N) { _npart = N; }
   inline int get_npart() const { return _npart; }
 
-  inline void set_tstep(const real_type &dt) { _tstep = dt; }
-  inline real_type get_tstep() const { return _tstep; }
+  inline void set_tstep(const compute_type &dt) { _tstep = dt; }
+  inline compute_type get_tstep() const { return _tstep; }
 
   inline void set_nsteps(const int &n) { _nsteps = n; }
   inline int get_nsteps() const { return _nsteps; }
@@ -65,7 +213,57 @@ class GSimulation {
   inline void set_sfreq(const int &sf) { _sfreq = sf; }
   inline int get_sfreq() const { return _sfreq; }
 
+  inline Layout get_layout() const { return _layout; }
+  inline bool get_pipelined() const { return _pipelined; }
+  inline Integrator get_integrator() const { return _integrator; }
+  inline int get_block_levels() const { return _blocklevels; }
+  inline const std::string &get_checkpoint() const { return _checkpoint; }
+  inline int get_checkpoint_freq() const { return _ckfreq; }
+  inline const std::string &get_restart() const { return _restart; }
+  inline const std::string &get_initial_conditions() const { return _ic; }
+  inline Model get_model() const { return _model; }
+  inline uint64_t get_seed() const { return _seed; }
+  inline const std::string &get_snapshot() const { return _snapshot; }
+  inline int get_snapshot_freq() const { return _snapfreq; }
+  inline unsigned get_snapshot_fields() const { return _snapfields; }
+  inline double get_snapshot_error() const { return _snaperror; }
+  inline compute_type get_eta() const { return _eta; }
+
+  inline Solver get_solver() const { return _solver; }
+  inline ForceKernel get_force_kernel() const { return _kernel; }
+  inline Softening get_softening() const { return _softening; }
+  inline Rsqrt get_rsqrt() const { return _rsqrt; }
+  inline KernelPrecision get_kernel_precision() const { return _kprecision; }
+  inline int get_iblock() const { return _iblock; }
+  inline Memory get_memory() const { return _memory; }
+  inline Split get_split() const { return _split; }
+  inline int get_sort_freq() const { return _sortfreq; }
+  inline Curve get_curve() const { return _curve; }
+  inline const std::string &get_report() const { return _report; }
+  inline int get_ensemble() const { return _systems; }
+
+  inline void set_wgsize(const int &wg) { _wgsize = wg; }
+  inline int get_wgsize() const { return _wgsize; }
+
+  inline void set_tilesize(const int &tile) { _tilesize = tile; }
+  inline int get_tilesize() const { return _tilesize; }
+
+  template <class Step, class Output>
+  void run(Step step, Output output);
+  template <class Step, class Output>
+  void run_pipelined(Step step, Output output);
+  bool checkpoint_due(int s) const;
+  bool snapshot_due(int s) const;
+  bool sort_due(int s) const;
+
+  void run_ensemble();
+  void reset_stats();
+
   void print_header();
+  std::string kernel_variant() const;
+  void print_step(int s, double elapsedseconds, double gflops);
+  void print_summary();
+  void write_report(int nthreads);
 };
 
 #endif
@@ -0,0 +1,34 @@
+#ifndef _INTEGRATOR_HPP
+#define _INTEGRATOR_HPP
+
+// scheme advancing the particles by one time step
+enum class Integrator { Euler, Leapfrog, Yoshida4, Hermite4 };
+
+// Schemes composed of kick-drift-kick substeps. A step of "stages" substeps
+// kicks the velocities by kick[0] * dt, then for every stage k drifts the
+// positions by drift[k] * dt, computes the accelerations and kicks by
+// kick[k + 1] * dt, so that the half kicks of neighbouring substeps are merged.
+template <Integrator I>
+struct KDKScheme;
+
+// second order leapfrog
+template <>
+struct KDKScheme<Integrator::Leapfrog> {
+  static constexpr int stages = 1;
+  static constexpr double drift[1] = {1.};
+  static constexpr double kick[2] = {0.5, 0.5};
+};
+
+// fourth order Yoshida (1990): three leapfrog substeps of w1, w0, w1 with
+// w1 = 1 / (2 - 2^(1/3)) and w0 = 1 - 2 w1
+template <>
+struct KDKScheme<Integrator::Yoshida4> {
+  static constexpr double w1 = 1.3512071919596578;
+  static constexpr double w0 = -1.7024143839193153;
+  static constexpr int stages = 3;
+  static constexpr double drift[3] = {w1, w0, w1};
+  static constexpr double kick[4] = {0.5 * w1, 0.5 * (w1 + w0),
+                                     0.5 * (w0 + w1), 0.5 * w1};
+};
+
+#endif
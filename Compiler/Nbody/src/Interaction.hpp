@@ -0,0 +1,117 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#ifndef _INTERACTION_HPP
+#define _INTERACTION_HPP
+
+#include <type_traits>
+
+#include <CL/sycl.hpp>
+#include "constants.hpp"
+#include "type.hpp"
+
+// Pair interaction of the specialised force kernels, fixed at compile time.
+// The acceleration of particle i is the sum over j of G m_j dx * f(r^2),
+// with f = 1 / r^3 far from the particle and softened close to it.
+
+// softening of the force at short distances: Plummer, f = (r^2 + eps^2)^-3/2,
+// or the cubic spline of Monaghan & Lattanzio (1985), exactly Newtonian beyond
+// h = 2.8 eps, where its potential at r = 0 matches the Plummer one
+enum class Softening { Plummer, Spline };
+
+// evaluation of 1 / sqrt(x): 1 / sqrt, the native rsqrt of the device, or
+// the native rsqrt refined with one Newton-Raphson iteration
+enum class Rsqrt { Exact, Native, Newton };
+
+template <Rsqrt R, class T>
+inline T inverse_sqrt(T x) {
+  if constexpr (R == Rsqrt::Exact) {
+    return T(1) / sycl::sqrt(x);
+  } else {
+    // only single precision has a native variant
+    T y;
+    if constexpr (std::is_same<T, float>::value)
+      y = sycl::native::rsqrt(x);
+    else
+      y = sycl::rsqrt(x);
+    if constexpr (R == Rsqrt::Newton) y = y * (T(1.5) - T(0.5) * x * y * y);
+    return y;
+  }
+}
+
+// f(r^2) of the softening law
+template <Softening S, Rsqrt R, class T>
+inline T inverse_cube(T r2) {
+  if constexpr (S == Softening::Plummer) {
+    const T y = inverse_sqrt<R>(r2 + T(softeningSquared));
+    return y * y * y;
+  } else {
+    const T h = T(2.8) * sycl::sqrt(T(softeningSquared));
+    const T hinv = T(1) / h;
+    if (r2 >= h * h) {
+      const T y = inverse_sqrt<R>(r2);
+      return y * y * y;
+    }
+    // r = 0 is the particle itself, whose dx is 0 anyway
+    const T u = r2 > T(0) ? r2 * inverse_sqrt<R>(r2) * hinv : T(0);
+    const T hinv3 = hinv * hinv * hinv;
+    if (u < T(0.5))
+      return hinv3 * (T(10.666666666667) + u * u * (T(32) * u - T(38.4)));
+    return hinv3 * (T(21.333333333333) - T(48) * u + T(38.4) * u * u -
+                    T(10.666666666667) * u * u * u -
+                    T(0.066666666667) / (u * u * u));
+  }
+}
+
+// Body of the tiled force kernels of the direct solver and of the ensemble.
+// Adds to acc the accelerations at (xi, yi, zi) due to the n j-particles from
+// "first" of x, y, z and m, which the wgsize work-items of the group of "it"
+// stage in the local arrays tx, ty, tz and tm, tilesize particles at a time.
+// Every work-item of the group calls it, including the padding ones.
+template <int D, class In, class Tile>
+inline void tiled_accelerations(const sycl::nd_item<D>& it, int wgsize,
+                                int tilesize, const In& x, const In& y,
+                                const In& z, const In& m, int first, int n,
+                                const Tile& tx, const Tile& ty, const Tile& tz,
+                                const Tile& tm, compute_type xi,
+                                compute_type yi, compute_type zi,
+                                accum_type& acc0, accum_type& acc1,
+                                accum_type& acc2) {
+  const int li = it.get_local_id(D - 1);
+  for (int jt = 0; jt < n; jt += tilesize) {
+    const int ntile = sycl::min(tilesize, n - jt);
+    for (int k = li; k < ntile; k += wgsize) {
+      tx[k] = x[first + jt + k];
+      ty[k] = y[first + jt + k];
+      tz[k] = z[first + jt + k];
+      tm[k] = m[first + jt + k];
+    }
+    group_barrier(it.get_group());
+    for (int k = 0; k < ntile; k++) {
+      compute_type dx, dy, dz;
+      compute_type distanceSqr = 0.0;
+      compute_type distanceInv = 0.0;
+
+      dx = compute_type(tx[k]) - xi;  // 1flop
+      dy = compute_type(ty[k]) - yi;  // 1flop
+      dz = compute_type(tz[k]) - zi;  // 1flop
+
+      distanceSqr = dx * dx + dy * dy + dz * dz + softeningSquared;  // 6flops
+      distanceInv = 1.0 / sycl::sqrt(distanceSqr);  // 1div+1sqrt
+
+      acc0 += dx * G * compute_type(tm[k]) * distanceInv * distanceInv *
+              distanceInv;  // 6flops
+      acc1 += dy * G * compute_type(tm[k]) * distanceInv * distanceInv *
+              distanceInv;  // 6flops
+      acc2 += dz * G * compute_type(tm[k]) * distanceInv * distanceInv *
+              distanceInv;  // 6flops
+    }
+    // the tile is overwritten in the next iteration
+    group_barrier(it.get_group());
+  }
+}
+
+#endif
@@ -0,0 +1,155 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#include "Models.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Random.hpp"
+#include "constants.hpp"
+
+static const double pi = 3.141592653589793;
+
+static void set_particle(Particle &p, double x, double y, double z, double vx,
+                         double vy, double vz, double m) {
+  p.pos[0] = x;
+  p.pos[1] = y;
+  p.pos[2] = z;
+  p.vel[0] = vx;
+  p.vel[1] = vy;
+  p.vel[2] = vz;
+  p.mass = m;
+}
+
+// Plummer sphere in Henon units (Aarseth, Henon and Wielen, 1974): scale
+// radius 3 pi / 16, radii truncated at 10 scale radii, speeds from the
+// isotropic distribution function by rejection
+static void plummer(Particle *p, int n, const Philox &g, double m) {
+  const double a = 3. * pi / 16.;
+#pragma omp parallel for
+  for (int i = 0; i < n; ++i) {
+    RandomStream r(g, i);
+    double rad;
+    do {
+      rad = a / std::sqrt(std::pow(r.uniform(), -2. / 3.) - 1.);
+    } while (rad > 10. * a);
+    double q, y;
+    do {
+      q = r.uniform();
+      y = 0.1 * r.uniform();
+    } while (y > q * q * std::pow(1. - q * q, 3.5));
+    const double v = q * std::sqrt(2.) * std::pow(rad * rad + a * a, -0.25);
+    double x[3], u[3];
+    r.direction(x[0], x[1], x[2]);
+    r.direction(u[0], u[1], u[2]);
+    set_particle(p[i], rad * x[0], rad * x[1], rad * x[2], v * u[0], v * u[1],
+                 v * u[2], m);
+  }
+}
+
+// isotropic distribution function of the Hernquist model with G M = a = 1
+// (Hernquist 1990, eq. 17), up to a constant, at the binding energy e
+static double hernquist_df(double e) {
+  const double q = std::sqrt(std::min(e, 1. - 1e-12));
+  const double s = 1. - q * q;
+  return (3. * std::asin(q) +
+          q * std::sqrt(s) * (1. - 2. * q * q) * (8. * q * q * q * q -
+                                                  8. * q * q - 3.)) /
+         std::pow(s, 2.5);
+}
+
+// Hernquist (1990) model with unit scale radius, truncated at 100 scale
+// radii. The speed is drawn from v^2 f(psi - v^2 / 2) by rejection under the
+// maximum of a grid of speeds.
+static void hernquist(Particle *p, int n, const Philox &g, double m) {
+  const int ngrid = 32;
+#pragma omp parallel for
+  for (int i = 0; i < n; ++i) {
+    RandomStream r(g, i);
+    double rad;
+    do {
+      const double s = std::sqrt(r.uniform());
+      rad = s / (1. - s);
+    } while (rad > 100.);
+    const double psi = 1. / (1. + rad);
+    const double vesc = std::sqrt(2. * psi);
+    double fmax = 0.;
+    for (int k = 1; k < ngrid; ++k) {
+      const double v = vesc * k / ngrid;
+      fmax = std::max(fmax, v * v * hernquist_df(psi - 0.5 * v * v));
+    }
+    fmax *= 1.2;
+    double v;
+    do {
+      v = vesc * r.uniform();
+    } while (fmax * r.uniform() > v * v * hernquist_df(psi - 0.5 * v * v));
+    double x[3], u[3];
+    r.direction(x[0], x[1], x[2]);
+    r.direction(u[0], u[1], u[2]);
+    set_particle(p[i], rad * x[0], rad * x[1], rad * x[2], v * u[0], v * u[1],
+                 v * u[2], m);
+  }
+}
+
+// Exponential disk with unit scale length and a sech^2 vertical profile of
+// scale height 0.1, truncated at 10 scale lengths. The particles rotate with
+// the circular velocity of the disk (Freeman 1970) plus a Gaussian
+// dispersion, which in z is that of an isothermal sheet, pi G Sigma z0.
+static void disk(Particle *p, int n, const Philox &g, double m) {
+  const double z0 = 0.1;
+  const double rmax = 10.;
+  const double mmax = 1. - (1. + rmax) * std::exp(-rmax);
+#pragma omp parallel for
+  for (int i = 0; i < n; ++i) {
+    RandomStream r(g, i);
+    // inverts the enclosed mass 1 - (1 + R) exp(-R) by bisection
+    const double u = mmax * r.uniform();
+    double lo = 0., hi = rmax;
+    for (int it = 0; it < 60; ++it) {
+      const double mid = 0.5 * (lo + hi);
+      if (1. - (1. + mid) * std::exp(-mid) < u)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    const double R = std::max(0.5 * (lo + hi), 1e-8);
+    const double z = z0 * std::atanh(r.uniform(-1., 1.));
+    const double phi = 2. * pi * r.uniform();
+
+    const double sigma = std::exp(-R) / (2. * pi);  // surface density
+    const double y = 0.5 * R;
+    const double vc = std::sqrt(std::max(
+        0., 2. * y * y * (std::cyl_bessel_i(0., y) * std::cyl_bessel_k(0., y) -
+                          std::cyl_bessel_i(1., y) * std::cyl_bessel_k(1., y))));
+    const double disp = std::sqrt(pi * sigma * z0);
+    const double vr = disp * r.normal();
+    const double vphi = vc + disp * r.normal();
+    const double vz = disp * r.normal();
+    const double c = std::cos(phi), s = std::sin(phi);
+    set_particle(p[i], R * c, R * s, z, vr * c - vphi * s, vr * s + vphi * c,
+                 vz, m);
+  }
+}
+
+void sample_model(Model model, Particle *p, int n, uint64_t seed) {
+  // masses in the units of the force kernels, G M = 1 for the whole system
+  const double m = 1. / (double(G) * n);
+  const Philox g(seed, 3);
+  switch (model) {
+    case Model::Plummer:
+      plummer(p, n, g, m);
+      break;
+    case Model::Hernquist:
+      hernquist(p, n, g, m);
+      break;
+    case Model::Disk:
+      disk(p, n, g, m);
+      break;
+    default:
+      break;
+  }
+}
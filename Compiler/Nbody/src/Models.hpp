@@ -0,0 +1,25 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#ifndef _MODELS_HPP
+#define _MODELS_HPP
+
+#include <cstdint>
+
+#include "Particle.hpp"
+
+// Initial particle distributions. Cube is the random cube of the original
+// sample; the others are equilibrium models with a total mass of 1/G, so that
+// G M = 1 and the dynamical time is of order one in the units of the time
+// step.
+enum class Model { Cube, Plummer, Hernquist, Disk };
+
+// Samples the positions, velocities and masses of the n particles of a
+// Plummer, Hernquist or exponential disk model in parallel with OpenMP. The
+// result only depends on the seed.
+void sample_model(Model model, Particle *p, int n, uint64_t seed);
+
+#endif
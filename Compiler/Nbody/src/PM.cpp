@@ -0,0 +1,180 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#include "PM.hpp"
+
+#include <cmath>
+
+#include "constants.hpp"
+
+const double pi = 3.14159265358979323846;
+
+PM::PM() : _box(1.) { set_grid(64); }
+
+void PM::set_grid(int n) {
+  int bits = 0;
+  while ((1 << bits) < n) ++bits;
+  _grid = 1 << bits;
+  _twiddle.resize(_grid / 2);
+  for (int k = 0; k < _grid / 2; ++k)
+    _twiddle[k] = std::polar(1., -2. * pi * k / _grid);
+  _bitrev.resize(_grid);
+  for (int k = 0; k < _grid; ++k) {
+    int r = 0;
+    for (int b = 0; b < bits; ++b) r |= ((k >> b) & 1) << (bits - 1 - b);
+    _bitrev[k] = r;
+  }
+}
+
+// Cells of the cloud of a particle along one axis, the cell below the
+// particle and the next one, and their weights. The cells are centered on
+// (i + 1/2) h and the positions are wrapped into the box.
+void PM::cloud(double x, int *i, double *w) const {
+  double u = x * _grid / _box - 0.5;
+  u -= _grid * std::floor(u / _grid);
+  const double f = std::floor(u);
+  i[0] = int(f) % _grid;
+  i[1] = i[0] + 1 == _grid ? 0 : i[0] + 1;
+  w[1] = u - f;
+  w[0] = 1. - w[1];
+}
+
+// Transforms all the lines of the mesh along one axis with an iterative
+// radix-2 FFT. Line l starts at (l / grid) * step + (l % grid) * stride2 and
+// its elements are "stride" apart.
+void PM::fft_lines(std::size_t stride, std::size_t step, bool inverse) {
+  const int ng = _grid;
+  const std::size_t stride2 = stride == 1 ? ng : 1;
+#pragma omp parallel
+  {
+    std::vector<std::complex<double>> line(ng);
+#pragma omp for
+    for (int l = 0; l < ng * ng; ++l) {
+      std::complex<double> *p =
+          _mesh.data() + (l / ng) * step + (l % ng) * stride2;
+      for (int k = 0; k < ng; ++k) line[_bitrev[k]] = p[k * stride];
+      for (int len = 2; len <= ng; len <<= 1) {
+        const int half = len / 2;
+        const int tstep = ng / len;
+        for (int s = 0; s < ng; s += len)
+          for (int k = 0; k < half; ++k) {
+            std::complex<double> w = _twiddle[k * tstep];
+            if (inverse) w = std::conj(w);
+            const std::complex<double> t = w * line[s + k + half];
+            line[s + k + half] = line[s + k] - t;
+            line[s + k] += t;
+          }
+      }
+      for (int k = 0; k < ng; ++k) p[k * stride] = line[k];
+    }
+  }
+}
+
+// 3D transform of the mesh, the inverse is not normalized
+void PM::fft(bool inverse) {
+  const std::size_t ng = _grid;
+  fft_lines(1, ng * ng, inverse);    // k, lines (i, j)
+  fft_lines(ng, ng * ng, inverse);   // j, lines (i, k)
+  fft_lines(ng * ng, ng, inverse);   // i, lines (j, k)
+}
+
+double PM::accelerations(const real_type *x, const real_type *y,
+                         const real_type *z, const real_type *m,
+                         real_type *ax, real_type *ay, real_type *az, int n) {
+  const int ng = _grid;
+  const std::size_t ncell = std::size_t(ng) * ng * ng;
+  const double h = _box / ng;
+  _rho.assign(ncell, 0.);
+  _mesh.resize(ncell);
+  for (auto &a : _acc) a.resize(ncell);
+
+  // cloud-in-cell mass assignment
+#pragma omp parallel for
+  for (int p = 0; p < n; ++p) {
+    int ix[2], iy[2], iz[2];
+    double wx[2], wy[2], wz[2];
+    cloud(x[p], ix, wx);
+    cloud(y[p], iy, wy);
+    cloud(z[p], iz, wz);
+    for (int a = 0; a < 2; ++a)
+      for (int b = 0; b < 2; ++b)
+        for (int c = 0; c < 2; ++c) {
+          const double dm = m[p] * wx[a] * wy[b] * wz[c];
+#pragma omp atomic
+          _rho[cell(ix[a], iy[b], iz[c])] += dm;
+        }
+  }
+
+  // Poisson equation in Fourier space, phi_k = -4 pi G rho_k / k^2, with the
+  // mean density removed (k = 0). Dividing out the window of the clouds would
+  // amplify the aliased modes at this resolution, so the Green's function is
+  // left unfiltered.
+  const double scale = 1. / (h * h * h) / double(ncell);
+#pragma omp parallel for
+  for (std::size_t c = 0; c < ncell; ++c) _mesh[c] = _rho[c];
+  fft(false);
+  std::vector<double> kv(ng);
+  for (int i = 0; i < ng; ++i)
+    kv[i] = 2. * pi / _box * (i <= ng / 2 ? i : i - ng);
+#pragma omp parallel for
+  for (int i = 0; i < ng; ++i)
+    for (int j = 0; j < ng; ++j)
+      for (int k = 0; k < ng; ++k) {
+        const double k2 = kv[i] * kv[i] + kv[j] * kv[j] + kv[k] * kv[k];
+        _mesh[cell(i, j, k)] *= k2 > 0. ? -4. * pi * G * scale / k2 : 0.;
+      }
+  fft(true);
+#pragma omp parallel for
+  for (std::size_t c = 0; c < ncell; ++c) _rho[c] = _mesh[c].real();
+
+  // a = -grad phi with fourth order central differences
+  const double d1 = 8. / (12. * h), d2 = 1. / (12. * h);
+  auto wrap = [ng](int i) { return (i + ng) % ng; };
+#pragma omp parallel for
+  for (int i = 0; i < ng; ++i)
+    for (int j = 0; j < ng; ++j)
+      for (int k = 0; k < ng; ++k) {
+        const std::size_t c = cell(i, j, k);
+        _acc[0][c] = -(d1 * (_rho[cell(wrap(i + 1), j, k)] -
+                             _rho[cell(wrap(i - 1), j, k)]) -
+                       d2 * (_rho[cell(wrap(i + 2), j, k)] -
+                             _rho[cell(wrap(i - 2), j, k)]));
+        _acc[1][c] = -(d1 * (_rho[cell(i, wrap(j + 1), k)] -
+                             _rho[cell(i, wrap(j - 1), k)]) -
+                       d2 * (_rho[cell(i, wrap(j + 2), k)] -
+                             _rho[cell(i, wrap(j - 2), k)]));
+        _acc[2][c] = -(d1 * (_rho[cell(i, j, wrap(k + 1))] -
+                             _rho[cell(i, j, wrap(k - 1))]) -
+                       d2 * (_rho[cell(i, j, wrap(k + 2))] -
+                             _rho[cell(i, j, wrap(k - 2))]));
+      }
+
+  // interpolation with the same cloud
+#pragma omp parallel for
+  for (int p = 0; p < n; ++p) {
+    int ix[2], iy[2], iz[2];
+    double wx[2], wy[2], wz[2];
+    cloud(x[p], ix, wx);
+    cloud(y[p], iy, wy);
+    cloud(z[p], iz, wz);
+    double acc[3] = {0., 0., 0.};
+    for (int a = 0; a < 2; ++a)
+      for (int b = 0; b < 2; ++b)
+        for (int c = 0; c < 2; ++c) {
+          const double w = wx[a] * wy[b] * wz[c];
+          const std::size_t cc = cell(ix[a], iy[b], iz[c]);
+          for (int d = 0; d < 3; ++d) acc[d] += w * _acc[d][cc];
+        }
+    ax[p] += acc[0];
+    ay[p] += acc[1];
+    az[p] += acc[2];
+  }
+
+  // weights and assignment 45 flops, interpolation 69 per particle; two 3D
+  // FFTs of 5 N log2 N; Green's function 8, differences 21 per cell
+  const double logn = 3. * std::log2(double(ng));
+  return 114. * n + 2. * 5. * double(ncell) * logn + 29. * double(ncell);
+}
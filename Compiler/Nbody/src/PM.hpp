@@ -0,0 +1,57 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#ifndef _PM_HPP
+#define _PM_HPP
+
+#include <complex>
+#include <vector>
+
+#include "type.hpp"
+
+// Particle-mesh solver for a periodic cubic box with its lower corner at the
+// origin. The masses are assigned to a uniform grid with the cloud-in-cell
+// scheme, the Poisson equation is solved with FFTs, the accelerations are
+// taken from fourth order finite differences of the potential and
+// interpolated back to the particles with the same scheme. Every pass runs
+// in parallel with OpenMP.
+class PM {
+ public:
+  PM();
+
+  // cells along each side of the grid, rounded up to a power of 2
+  void set_grid(int n);
+  int get_grid() const { return _grid; }
+
+  // side of the periodic box
+  void set_box(double l) { _box = l; }
+  double get_box() const { return _box; }
+
+  // Adds the accelerations of all the particles to ax, ay and az.
+  // Returns the number of flops spent.
+  double accelerations(const real_type *x, const real_type *y,
+                       const real_type *z, const real_type *m, real_type *ax,
+                       real_type *ay, real_type *az, int n);
+
+ private:
+  int _grid;
+  double _box;
+
+  std::vector<double> _rho;                   // mass, then potential
+  std::vector<double> _acc[3];                // accelerations on the grid
+  std::vector<std::complex<double>> _mesh;    // transform of the density
+  std::vector<std::complex<double>> _twiddle; // exp(-2 pi i k / grid)
+  std::vector<int> _bitrev;                   // bit reversed indices
+
+  std::size_t cell(int i, int j, int k) const {
+    return (std::size_t(i) * _grid + j) * _grid + k;
+  }
+  void cloud(double x, int *i, double *w) const;
+  void fft_lines(std::size_t stride, std::size_t step, bool inverse);
+  void fft(bool inverse);
+};
+
+#endif
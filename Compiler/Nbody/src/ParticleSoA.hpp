@@ -0,0 +1,124 @@
+#ifndef _PARTICLESOA_HPP
+#define _PARTICLESOA_HPP
+
+#include <stdlib.h>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "Particle.hpp"
+
+// Structure-of-Arrays particle storage. Each component lives in its own
+// contiguous array, so the force loop only streams the positions and masses of
+// the j-particles instead of the whole 40-byte Particle. All arrays are carved
+// out of a single allocation, and each one starts on a 64-byte boundary.
+struct ParticleSoA {
+ public:
+  static const int alignment = 64;
+  static const int nfields = 10;
+
+  ParticleSoA() : npart(0), stride(0), data(nullptr), owner(true) {
+    set_pointers();
+  }
+  ~ParticleSoA() { release(); }
+
+  ParticleSoA(const ParticleSoA &) = delete;
+  ParticleSoA &operator=(const ParticleSoA &) = delete;
+
+  void resize(int n) {
+    release();
+    const int chunk = alignment / sizeof(real_type);
+    npart = n;
+    stride = ((n + chunk - 1) / chunk) * chunk;
+    std::size_t bytes = sizeof(real_type) * nfields * stride;
+#ifdef _WIN32
+    data = static_cast<real_type *>(_aligned_malloc(bytes, alignment));
+#else
+    void *ptr = nullptr;
+    data = posix_memalign(&ptr, alignment, bytes) ? nullptr
+                                                 : static_cast<real_type *>(ptr);
+#endif
+    if (bytes && !data) throw std::bad_alloc();
+    std::memset(data, 0, bytes);
+    set_pointers();
+  }
+
+  void release() {
+    if (owner) {
+#ifdef _WIN32
+      _aligned_free(data);
+#else
+      free(data);
+#endif
+    }
+    data = nullptr;
+    owner = true;
+    npart = stride = 0;
+    set_pointers();
+  }
+
+  // Uses the nfields arrays of "s" elements at "d" without copying them, for
+  // example a memory-mapped checkpoint. The memory stays owned by the caller.
+  void attach(real_type *d, int n, int s) {
+    release();
+    npart = n;
+    stride = s;
+    data = d;
+    owner = false;
+    set_pointers();
+  }
+
+  // copy from / to the Array-of-Structures representation
+  void load(const Particle *p) {
+    for (int i = 0; i < npart; ++i) {
+      pos_x[i] = p[i].pos[0];
+      pos_y[i] = p[i].pos[1];
+      pos_z[i] = p[i].pos[2];
+      vel_x[i] = p[i].vel[0];
+      vel_y[i] = p[i].vel[1];
+      vel_z[i] = p[i].vel[2];
+      acc_x[i] = p[i].acc[0];
+      acc_y[i] = p[i].acc[1];
+      acc_z[i] = p[i].acc[2];
+      mass[i] = p[i].mass;
+    }
+  }
+
+  void store(Particle *p) const {
+    for (int i = 0; i < npart; ++i) {
+      p[i].pos[0] = pos_x[i];
+      p[i].pos[1] = pos_y[i];
+      p[i].pos[2] = pos_z[i];
+      p[i].vel[0] = vel_x[i];
+      p[i].vel[1] = vel_y[i];
+      p[i].vel[2] = vel_z[i];
+      p[i].acc[0] = acc_x[i];
+      p[i].acc[1] = acc_y[i];
+      p[i].acc[2] = acc_z[i];
+      p[i].mass = mass[i];
+    }
+  }
+
+  int npart;        // number of particles
+  int stride;       // distance between two arrays, multiple of the alignment
+  real_type *data;  // single allocation holding all the arrays
+  bool owner;       // data was allocated by resize
+
+  real_type *pos_x, *pos_y, *pos_z;
+  real_type *vel_x, *vel_y, *vel_z;
+  real_type *acc_x, *acc_y, *acc_z;
+  real_type *mass;
+
+ private:
+  void set_pointers() {
+    real_type **fields[nfields] = {&pos_x, &pos_y, &pos_z, &vel_x, &vel_y,
+                                   &vel_z, &acc_x, &acc_y, &acc_z, &mass};
+    for (int f = 0; f < nfields; ++f)
+      *fields[f] = data ? data + f * stride : nullptr;
+  }
+};
+
+#endif
@@ -0,0 +1,118 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#include "Profile.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+// mean, standard deviation and nearest-rank percentiles
+static Profile::Stats statistics(std::vector<double> v) {
+  Profile::Stats s = {0., 0., 0., 0., 0., 0., 0.};
+  if (v.empty()) return s;
+  std::sort(v.begin(), v.end());
+  const double n = double(v.size());
+  double sum = 0., sum2 = 0.;
+  for (double x : v) {
+    sum += x;
+    sum2 += x * x;
+  }
+  auto rank = [&](double p) {
+    const std::size_t k = std::size_t(std::ceil(p * n));
+    return v[std::min(v.size() - 1, k ? k - 1 : 0)];
+  };
+  s.mean = sum / n;
+  s.stddev = std::sqrt(std::max(0., sum2 / n - s.mean * s.mean));
+  s.min = v.front();
+  s.p50 = rank(0.5);
+  s.p90 = rank(0.9);
+  s.p99 = rank(0.99);
+  s.max = v.back();
+  return s;
+}
+
+Profile::Stats Profile::gflops() const {
+  std::vector<double> v;
+  for (const Sample &s : _samples)
+    if (s.seconds > 0.) v.push_back(s.gflops / s.seconds);
+  return statistics(v);
+}
+
+Profile::Stats Profile::seconds() const {
+  std::vector<double> v;
+  for (const Sample &s : _samples) v.push_back(s.seconds);
+  return statistics(v);
+}
+
+double Profile::total(double Sample::*field) const {
+  double sum = 0.;
+  for (const Sample &s : _samples) sum += s.*field;
+  return sum;
+}
+
+static void write_stats(std::ostream &out, const char *name,
+                        const Profile::Stats &s) {
+  out << "  \"" << name << "\": {\"mean\": " << s.mean
+      << ", \"stddev\": " << s.stddev << ", \"min\": " << s.min
+      << ", \"p50\": " << s.p50 << ", \"p90\": " << s.p90
+      << ", \"p99\": " << s.p99 << ", \"max\": " << s.max << "},\n";
+}
+
+void Profile::write(
+    const std::string &path,
+    const std::vector<std::pair<std::string, std::string>> &run,
+    double total_time) const {
+  std::ofstream out(path);
+  if (!out) throw std::runtime_error("cannot write the report " + path);
+  out << std::setprecision(8);
+  const double time = total(&Sample::seconds);
+  const bool csv =
+      path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+
+  if (csv) {
+    // the description of the run as comments, then one row per sample
+    for (const auto &r : run) out << "# " << r.first << ": " << r.second << "\n";
+    out << "step,seconds,gflops,force_s,update_s,reduction_s,"
+           "interactions_per_s,bytes_per_s\n";
+    for (const Sample &s : _samples) {
+      const double t = s.seconds > 0. ? s.seconds : 1.;
+      out << s.step << "," << s.seconds << "," << s.gflops / t << ","
+          << s.force << "," << s.update << "," << s.reduction << ","
+          << s.interactions / t << "," << s.bytes / t << "\n";
+    }
+  } else {
+    out << "{\n  \"run\": {";
+    for (std::size_t k = 0; k < run.size(); ++k)
+      out << (k ? ", " : "") << "\"" << run[k].first << "\": " << run[k].second;
+    out << "},\n";
+    out << "  \"total_time\": " << total_time << ",\n";
+    out << "  \"samples\": " << _samples.size() << ",\n";
+    write_stats(out, "gflops", gflops());
+    write_stats(out, "step_time", seconds());
+    out << "  \"kernel_time\": {\"force\": " << total(&Sample::force)
+        << ", \"update\": " << total(&Sample::update)
+        << ", \"reduction\": " << total(&Sample::reduction) << "},\n";
+    out << "  \"interactions_per_s\": "
+        << (time > 0. ? total(&Sample::interactions) / time : 0.) << ",\n";
+    out << "  \"bytes_per_s\": "
+        << (time > 0. ? total(&Sample::bytes) / time : 0.) << ",\n";
+    out << "  \"steps\": [";
+    for (std::size_t k = 0; k < _samples.size(); ++k) {
+      const Sample &s = _samples[k];
+      out << (k ? ",\n" : "\n") << "    {\"step\": " << s.step
+          << ", \"seconds\": " << s.seconds << ", \"gflop\": " << s.gflops
+          << ", \"force\": " << s.force << ", \"update\": " << s.update
+          << ", \"reduction\": " << s.reduction
+          << ", \"interactions\": " << s.interactions
+          << ", \"bytes\": " << s.bytes << "}";
+    }
+    out << "\n  ]\n}\n";
+  }
+  if (!out) throw std::runtime_error("cannot write the report " + path);
+}
@@ -0,0 +1,57 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#ifndef _PROFILE_HPP
+#define _PROFILE_HPP
+
+#include <string>
+#include <vector>
+
+// Timings of the sampled steps of a run. The kernels of a step are timed from
+// the profiling information of their events, the forces computed on the host
+// with the host clock, and the statistics and all the samples are written as
+// a JSON or CSV report.
+class Profile {
+ public:
+  // one sampled step
+  struct Sample {
+    int step;
+    double seconds;       // time of the step
+    double gflops;        // flops of the step, in GFlop
+    double force;         // seconds in the force computation
+    double update;        // seconds in the integration kernels
+    double reduction;     // seconds reading back the kinetic energy
+    double interactions;  // pair interactions of the direct sum equivalent
+    double bytes;         // bytes read and written by the kernels
+  };
+
+  // percentiles and moments of one quantity over the samples
+  struct Stats {
+    double mean, stddev, min, p50, p90, p99, max;
+  };
+
+  void clear() { _samples.clear(); }
+  void add(const Sample &s) { _samples.push_back(s); }
+  const std::vector<Sample> &samples() const { return _samples; }
+
+  // statistics of the GFlops rate and of the time of the steps
+  Stats gflops() const;
+  Stats seconds() const;
+  // sum of one field over the samples
+  double total(double Sample::*field) const;
+
+  // Writes the report to "path", as CSV if its name ends with ".csv" and as
+  // JSON otherwise. "run" is a list of name/value pairs describing the run,
+  // the values already formatted for JSON. Throws std::runtime_error.
+  void write(const std::string &path,
+             const std::vector<std::pair<std::string, std::string>> &run,
+             double total_time) const;
+
+ private:
+  std::vector<Sample> _samples;
+};
+
+#endif
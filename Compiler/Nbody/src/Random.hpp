@@ -0,0 +1,97 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#ifndef _RANDOM_HPP
+#define _RANDOM_HPP
+
+#include <cmath>
+#include <cstdint>
+
+// Philox4x32-10 counter-based generator (Salmon et al., 2011). The random
+// words are a pure function of a 128-bit counter and a 64-bit key, so every
+// particle draws its own numbers from the counter (particle, draw, stream)
+// and the result does not depend on the order or the number of the threads.
+// generate() only uses integer arithmetic and can run in SYCL kernels too.
+class Philox {
+ public:
+  Philox(uint64_t seed, uint32_t stream)
+      : _key0(uint32_t(seed)), _key1(uint32_t(seed >> 32)), _stream(stream) {}
+
+  // four random words for the draw "k" of the element "i"
+  void generate(uint64_t i, uint32_t k, uint32_t out[4]) const {
+    uint32_t c0 = uint32_t(i), c1 = uint32_t(i >> 32), c2 = k, c3 = _stream;
+    uint32_t k0 = _key0, k1 = _key1;
+    for (int r = 0; r < 10; ++r) {
+      const uint64_t p0 = uint64_t(0xD2511F53u) * c0;
+      const uint64_t p1 = uint64_t(0xCD9E8D57u) * c2;
+      const uint32_t n0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+      const uint32_t n2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+      c1 = uint32_t(p1);
+      c3 = uint32_t(p0);
+      c0 = n0;
+      c2 = n2;
+      k0 += 0x9E3779B9u;
+      k1 += 0xBB67AE85u;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+  }
+
+ private:
+  uint32_t _key0, _key1, _stream;
+};
+
+// double in (0, 1) from two random words
+inline double uniform_open(uint32_t hi, uint32_t lo) {
+  const uint64_t bits = (uint64_t(hi) << 21) ^ (lo >> 11);
+  return (double(bits & ((uint64_t(1) << 53) - 1)) + 0.5) *
+         (1.0 / 9007199254740992.0);
+}
+
+// Sequence of random numbers of one particle: the draws of particle i are
+// the counters (i, 0), (i, 1), ... of the generator
+class RandomStream {
+ public:
+  RandomStream(const Philox &g, uint64_t i) : _g(g), _i(i), _k(0), _used(4) {}
+
+  // uniform in (0, 1)
+  double uniform() {
+    if (_used > 2) {
+      _g.generate(_i, _k++, _words);
+      _used = 0;
+    }
+    double u = uniform_open(_words[_used], _words[_used + 1]);
+    _used += 2;
+    return u;
+  }
+  double uniform(double a, double b) { return a + (b - a) * uniform(); }
+
+  // standard normal, Box-Muller
+  double normal() {
+    const double r = std::sqrt(-2. * std::log(uniform()));
+    return r * std::cos(6.283185307179586 * uniform());
+  }
+
+  // uniform on the unit sphere
+  void direction(double &x, double &y, double &z) {
+    z = uniform(-1., 1.);
+    const double phi = 6.283185307179586 * uniform();
+    const double s = std::sqrt(1. - z * z);
+    x = s * std::cos(phi);
+    y = s * std::sin(phi);
+  }
+
+ private:
+  const Philox &_g;
+  uint64_t _i;
+  uint32_t _k;
+  int _used;
+  uint32_t _words[4];
+};
+
+#endif
@@ -0,0 +1,314 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#include "Snapshot.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+static const char snapshot_magic[8] = {'N', 'B', 'O', 'D', 'Y', 'S', 'N', 'P'};
+static const char compressed_magic[8] = {'N', 'B', 'O', 'D',
+                                         'Y', 'S', 'N', 'Z'};
+
+static_assert(sizeof(SnapshotHeader) == 48,
+              "the snapshot header must keep its size");
+
+// first field of ParticleSoA and number of fields of each group
+static int field_offset(unsigned f) {
+  return f == SnapshotWriter::Position       ? 0
+         : f == SnapshotWriter::Velocity     ? 3
+         : f == SnapshotWriter::Acceleration ? 6
+                                             : 9;
+}
+
+static int field_count(unsigned f) { return f == SnapshotWriter::Mass ? 1 : 3; }
+
+static int selected_arrays(unsigned fields) {
+  int n = 0;
+  for (unsigned f = 1; f <= SnapshotWriter::Mass; f <<= 1)
+    if (fields & f) n += field_count(f);
+  return n;
+}
+
+// marks the arrays of ParticleSoA written with "fields"
+static void select_arrays(unsigned fields, bool present[]) {
+  for (int a = 0; a < ParticleSoA::nfields; ++a) present[a] = false;
+  for (unsigned f = 1; f <= SnapshotWriter::Mass; f <<= 1)
+    for (int k = 0; k < field_count(f); ++k)
+      present[field_offset(f) + k] = (fields & f) != 0;
+}
+
+SnapshotWriter::SnapshotWriter()
+    : _file(nullptr), _fields(0), _error(0.), _chunk(0), _head(0), _tail(0),
+      _done(false), _failed(false), _stall(0.), _raw_bytes(0),
+      _written_bytes(0) {}
+
+SnapshotWriter::~SnapshotWriter() {
+  try {
+    close();
+  } catch (const std::runtime_error &) {
+  }
+}
+
+void SnapshotWriter::open(const std::string &path, unsigned fields,
+                          double error, int chunk_size) {
+  close();
+  // the compression runs on the writer thread, which cannot report errors
+  if (error > 0. && (fields & Position) && error < min_snapshot_error()) {
+    std::ostringstream msg;
+    msg << "the snapshot error bound must be at least " << min_snapshot_error();
+    throw std::runtime_error(msg.str());
+  }
+  _file = std::fopen(path.c_str(), "wb");
+  if (!_file) throw std::runtime_error("cannot create snapshot file " + path);
+  _error = error;
+  // the order of the particles is only kept by uncompressed snapshots
+  _fields = fields & (error > 0. ? AllFields | Index : AllFields);
+  _chunk = std::max(chunk_size, 1);
+  _head = _tail = 0;
+  _done = _failed = false;
+  _stall = 0.;
+  _raw_bytes = _written_bytes = 0;
+  _thread = std::thread(&SnapshotWriter::writer_loop, this);
+}
+
+void SnapshotWriter::close() {
+  if (!_file) return;
+  _done = true;
+  _thread.join();
+  bool ok = std::fclose(_file) == 0 && !_failed;
+  _file = nullptr;
+  for (Slot &s : _slots) std::vector<real_type>().swap(s.data);
+  std::vector<uint8_t>().swap(_packed);
+  if (!ok) throw std::runtime_error("cannot write snapshot");
+}
+
+void SnapshotWriter::submit(const ParticleSoA &p, int64_t step, double time) {
+  // wait for a free slot: only when both are still being written
+  const int head = _head.load(std::memory_order_relaxed);
+  if (head - _tail.load(std::memory_order_acquire) == nslots) {
+    auto t0 = std::chrono::steady_clock::now();
+    while (head - _tail.load(std::memory_order_acquire) == nslots)
+      std::this_thread::yield();
+    _stall += std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            t0).count();
+  }
+
+  Slot &s = _slots[head % nslots];
+  s.data.resize(std::size_t(selected_arrays(_fields)) * p.npart);
+  const real_type *arrays[ParticleSoA::nfields] = {
+      p.pos_x, p.pos_y, p.pos_z, p.vel_x, p.vel_y,
+      p.vel_z, p.acc_x, p.acc_y, p.acc_z, p.mass};
+  real_type *dst = s.data.data();
+  for (unsigned f = 1; f <= Mass; f <<= 1) {
+    if (!(_fields & f)) continue;
+    for (int k = 0; k < field_count(f); ++k, dst += p.npart)
+      std::memcpy(dst, arrays[field_offset(f) + k],
+                  sizeof(real_type) * p.npart);
+  }
+
+  SnapshotHeader &h = s.header;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, _error > 0. ? compressed_magic : snapshot_magic,
+              sizeof(h.magic));
+  h.version = version;
+  h.real_size = sizeof(real_type);
+  h.fields = _fields;
+  h.chunk_size = _chunk;
+  h.npart = p.npart;
+  h.step = step;
+  h.time = time;
+
+  // publishes the slot to the writer thread
+  _head.store(head + 1, std::memory_order_release);
+}
+
+void SnapshotWriter::writer_loop() {
+  for (;;) {
+    const int tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) {
+      // the loop ends once no snapshot is pending after "done" was set
+      if (_done) {
+        if (tail == _head.load(std::memory_order_acquire)) return;
+        continue;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    if (!write(_slots[tail % nslots])) _failed = true;
+    _tail.store(tail + 1, std::memory_order_release);
+  }
+}
+
+bool SnapshotWriter::write(const Slot &s) {
+  if (_failed) return false;
+  const SnapshotHeader &h = s.header;
+  const std::size_t n = std::size_t(h.npart);
+  const int narrays = int(s.data.size() / std::max<std::size_t>(n, 1));
+  _raw_bytes += sizeof(h) + sizeof(real_type) * s.data.size();
+  if (_error > 0.) return write_compressed(s);
+  _written_bytes += sizeof(h) + sizeof(real_type) * s.data.size();
+  bool ok = std::fwrite(&h, sizeof(h), 1, _file) == 1;
+  for (std::size_t i = 0; ok && i < n; i += h.chunk_size) {
+    const std::size_t len = std::min<std::size_t>(h.chunk_size, n - i);
+    for (int a = 0; ok && a < narrays; ++a)
+      ok = std::fwrite(s.data.data() + a * n + i, sizeof(real_type), len,
+                       _file) == len;
+  }
+  return ok && std::fflush(_file) == 0;
+}
+
+bool SnapshotWriter::write_compressed(const Slot &s) {
+  const SnapshotHeader &h = s.header;
+  const real_type *arrays[ParticleSoA::nfields];
+  bool present[ParticleSoA::nfields];
+  select_arrays(h.fields, present);
+  const real_type *p = s.data.data();
+  for (int a = 0; a < ParticleSoA::nfields; ++a) {
+    arrays[a] = present[a] ? p : nullptr;
+    if (present[a]) p += h.npart;
+  }
+  compress_snapshot(arrays, h.npart, (h.fields & Index) != 0, _error,
+                    int(h.chunk_size), _packed);
+  _written_bytes += sizeof(h) + _packed.size();
+  return std::fwrite(&h, sizeof(h), 1, _file) == 1 &&
+         std::fwrite(_packed.data(), 1, _packed.size(), _file) ==
+             _packed.size() &&
+         std::fflush(_file) == 0;
+}
+
+unsigned SnapshotWriter::parse_fields(const char *list) {
+  static const struct {
+    const char *name;
+    unsigned field;
+  } names[] = {{"pos", Position}, {"vel", Velocity},
+               {"acc", Acceleration}, {"mass", Mass}, {"id", Index},
+               {"all", AllFields}};
+  unsigned fields = 0;
+  while (*list) {
+    const char *end = std::strchr(list, ',');
+    std::size_t len = end ? std::size_t(end - list) : std::strlen(list);
+    unsigned f = 0;
+    for (const auto &n : names)
+      if (std::strlen(n.name) == len && !std::strncmp(list, n.name, len))
+        f = n.field;
+    if (!f) return 0;
+    fields |= f;
+    list += len;
+    if (*list) ++list;
+  }
+  return fields;
+}
+
+SnapshotReader::SnapshotReader()
+    : _file(nullptr), _compressed(false), _done(0), _chunks(0) {
+  std::memset(&_header, 0, sizeof(_header));
+  std::memset(&_info, 0, sizeof(_info));
+}
+
+SnapshotReader::~SnapshotReader() { close(); }
+
+void SnapshotReader::open(const std::string &path) {
+  close();
+  _file = std::fopen(path.c_str(), "rb");
+  if (!_file) throw std::runtime_error("cannot open snapshot file " + path);
+  std::memset(&_header, 0, sizeof(_header));
+}
+
+void SnapshotReader::close() {
+  if (_file) std::fclose(_file);
+  _file = nullptr;
+  _header.npart = _done = 0;
+  _chunks = _info.nchunks = 0;
+}
+
+bool SnapshotReader::next_snapshot() {
+  skip();
+  if (std::fread(&_header, sizeof(_header), 1, _file) != 1) return false;
+  _compressed = !std::memcmp(_header.magic, compressed_magic, 8);
+  if ((!_compressed && std::memcmp(_header.magic, snapshot_magic, 8)) ||
+      _header.version != SnapshotWriter::version ||
+      _header.real_size != sizeof(real_type) || !_header.chunk_size)
+    throw std::runtime_error("unsupported snapshot");
+  select_arrays(_header.fields, _present);
+  _present[ParticleSoA::nfields] =
+      !_compressed || (_header.fields & SnapshotWriter::Index);
+  if (_compressed &&
+      std::fread(&_info, sizeof(_info), 1, _file) != 1)
+    throw std::runtime_error("truncated snapshot");
+  _done = 0;
+  _chunks = 0;
+  return true;
+}
+
+int SnapshotReader::next_chunk(std::vector<double> arrays[],
+                               std::vector<int64_t> &ids) {
+  if (_done >= _header.npart) return 0;
+  int count;
+  if (_compressed) {
+    ChunkHeader ch;
+    if (std::fread(&ch, sizeof(ch), 1, _file) != 1)
+      throw std::runtime_error("truncated snapshot");
+    _buf.resize(chunk_payload(ch));
+    if (std::fread(_buf.data(), 1, _buf.size(), _file) != _buf.size())
+      throw std::runtime_error("truncated snapshot");
+    decompress_chunk(_info, ch, _buf.data(), _present, arrays, ids);
+    if (!_present[ParticleSoA::nfields]) ids.clear();
+    count = int(ch.count);
+    ++_chunks;
+  } else {
+    count = int(std::min<int64_t>(_header.chunk_size, _header.npart - _done));
+    std::vector<real_type> v(count);
+    for (int a = 0; a < ParticleSoA::nfields; ++a) {
+      if (!_present[a]) continue;
+      if (std::fread(v.data(), sizeof(real_type), count, _file) !=
+          std::size_t(count))
+        throw std::runtime_error("truncated snapshot");
+      arrays[a].assign(v.begin(), v.end());
+    }
+    ids.resize(count);
+    for (int i = 0; i < count; ++i) ids[i] = _done + i;
+  }
+  _done += count;
+  return count;
+}
+
+// moves "offset" bytes forward, beyond 2 GB too: long is 32 bits on Windows
+static int seek_forward(FILE *f, int64_t offset) {
+#ifdef _WIN32
+  return _fseeki64(f, offset, SEEK_CUR);
+#else
+  return fseeko(f, off_t(offset), SEEK_CUR);
+#endif
+}
+
+// moves to the end of the current snapshot
+void SnapshotReader::skip() {
+  if (_done >= _header.npart) return;
+  if (_compressed) {
+    for (; _chunks < _info.nchunks; ++_chunks) {
+      ChunkHeader ch;
+      if (std::fread(&ch, sizeof(ch), 1, _file) != 1 ||
+          seek_forward(_file, int64_t(chunk_payload(ch))))
+        throw std::runtime_error("truncated snapshot");
+    }
+  } else {
+    int narrays = 0;
+    for (int a = 0; a < ParticleSoA::nfields; ++a) narrays += _present[a];
+    if (seek_forward(_file, int64_t(sizeof(real_type)) * narrays *
+                                (_header.npart - _done)))
+      throw std::runtime_error("truncated snapshot");
+  }
+  _done = _header.npart;
+}
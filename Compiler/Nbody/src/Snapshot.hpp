@@ -0,0 +1,152 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#ifndef _SNAPSHOT_HPP
+#define _SNAPSHOT_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ParticleSoA.hpp"
+#include "SnapshotCodec.hpp"
+
+// Header of one snapshot in a snapshot file. A file is a sequence of
+// snapshots, each made of this header followed by the particles in chunks of
+// "chunk_size": every chunk holds the selected fields, in the order of
+// ParticleSoA (x, y, z, vx, vy, vz, ax, ay, az, mass), for its particles.
+// Compressed snapshots (SnapshotCodec.hpp) are followed by a CompressedInfo
+// and the compressed chunks instead.
+struct SnapshotHeader {
+  char magic[8];         // "NBODYSNP", or "NBODYSNZ" if compressed
+  uint32_t version;      // version of the format
+  uint32_t real_size;    // size of one element, sizeof(real_type)
+  uint32_t fields;       // bit mask of SnapshotWriter::Field
+  uint32_t chunk_size;   // particles per chunk
+  int64_t npart;         // number of particles
+  int64_t step;          // time step of the snapshot
+  double time;           // simulated time
+};
+
+// Writes snapshots of the particles on a background thread. submit() copies
+// the selected fields into one of two staging slots and hands it over to the
+// writer thread through a single-producer single-consumer ring of atomic
+// counters, so the time step loop only waits when the writer is two
+// snapshots behind. The compression, if any, also runs on the writer thread.
+class SnapshotWriter {
+ public:
+  static const uint32_t version = 1;
+  static const int nslots = 2;
+
+  enum Field : unsigned {
+    Position = 1,
+    Velocity = 2,
+    Acceleration = 4,
+    Mass = 8,
+    AllFields = 15,
+    Index = 16  // original index of the particles in compressed snapshots
+  };
+
+  SnapshotWriter();
+  ~SnapshotWriter();
+
+  SnapshotWriter(const SnapshotWriter &) = delete;
+  SnapshotWriter &operator=(const SnapshotWriter &) = delete;
+
+  // Creates "path" and starts the writer thread. With error > 0 the
+  // snapshots are compressed with that error bound, at least
+  // min_snapshot_error() if the positions are written. Throws
+  // std::runtime_error.
+  void open(const std::string &path, unsigned fields, double error = 0.,
+            int chunk_size = 65536);
+  // Waits for the pending snapshots and stops the thread. Throws
+  // std::runtime_error if a snapshot could not be written.
+  void close();
+  bool is_open() const { return _file != nullptr; }
+
+  void submit(const ParticleSoA &p, int64_t step, double time);
+
+  int get_written() const { return _tail.load(); }
+  // seconds submit() waited for a free staging slot
+  double get_stall_time() const { return _stall; }
+  // size of the uncompressed over the written snapshots
+  double get_ratio() const {
+    return _written_bytes ? double(_raw_bytes) / double(_written_bytes) : 1.;
+  }
+
+  // parses a comma separated list of pos, vel, acc, mass and id; 0 if
+  // invalid
+  static unsigned parse_fields(const char *list);
+
+ private:
+  struct Slot {
+    std::vector<real_type> data;  // selected fields, npart elements each
+    SnapshotHeader header;
+  };
+
+  FILE *_file;
+  unsigned _fields;
+  double _error;
+  int _chunk;
+  Slot _slots[nslots];
+  // the producer fills slot _head % nslots and then increments _head, the
+  // writer writes slot _tail % nslots and then increments _tail
+  std::atomic<int> _head, _tail;
+  std::atomic<bool> _done, _failed;
+  std::thread _thread;
+  double _stall;
+  // written by the writer thread, read after close
+  uint64_t _raw_bytes, _written_bytes;
+  std::vector<uint8_t> _packed;
+
+  void writer_loop();
+  bool write(const Slot &s);
+  bool write_compressed(const Slot &s);
+};
+
+// Reads the snapshots of a file one chunk at a time, compressed or not, so
+// that a snapshot never has to fit in memory as a whole.
+class SnapshotReader {
+ public:
+  SnapshotReader();
+  ~SnapshotReader();
+
+  SnapshotReader(const SnapshotReader &) = delete;
+  SnapshotReader &operator=(const SnapshotReader &) = delete;
+
+  // Throws std::runtime_error.
+  void open(const std::string &path);
+  void close();
+
+  // Skips what is left of the current snapshot and reads the header of the
+  // next one. Returns false at the end of the file.
+  bool next_snapshot();
+  const SnapshotHeader &header() const { return _header; }
+  bool compressed() const { return _compressed; }
+
+  // Decodes the next chunk of the current snapshot: one vector per field of
+  // ParticleSoA that is present, and the original indices of the particles
+  // in "ids" (empty if a compressed snapshot does not store them). Returns
+  // the number of particles, 0 after the last chunk.
+  int next_chunk(std::vector<double> arrays[], std::vector<int64_t> &ids);
+
+ private:
+  FILE *_file;
+  SnapshotHeader _header;
+  CompressedInfo _info;
+  bool _compressed;
+  bool _present[ParticleSoA::nfields + 1];  // arrays and ids
+  int64_t _done;                            // particles already read
+  uint32_t _chunks;                         // compressed chunks read
+  std::vector<uint8_t> _buf;
+
+  void skip();
+};
+
+#endif
@@ -0,0 +1,306 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#include "SnapshotCodec.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "SpatialSort.hpp"
+
+// byte-wise rANS with 12-bit probabilities and a 32-bit state
+static const int prob_bits = 12;
+static const uint32_t prob_scale = 1u << prob_bits;
+static const uint32_t rans_low = 1u << 23;
+static const std::size_t freq_table_bytes = 256 * sizeof(uint16_t);
+
+static void put_varint(std::vector<uint8_t> &out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(uint8_t(v) | 0x80);
+    v >>= 7;
+  }
+  out.push_back(uint8_t(v));
+}
+
+static uint64_t get_varint(const uint8_t *&p, const uint8_t *end) {
+  uint64_t v = 0;
+  for (int shift = 0; p < end && shift < 64; shift += 7) {
+    uint8_t b = *p++;
+    v |= uint64_t(b & 0x7f) << shift;
+    if (!(b & 0x80)) return v;
+  }
+  throw std::runtime_error("corrupted snapshot chunk");
+}
+
+static uint64_t zigzag(int64_t v) {
+  return (uint64_t(v) << 1) ^ uint64_t(v >> 63);
+}
+static int64_t unzigzag(uint64_t v) {
+  return int64_t(v >> 1) ^ -int64_t(v & 1);
+}
+
+// Scales the byte counts to frequencies summing to prob_scale, keeping every
+// byte that occurs at a frequency of at least 1
+static void normalize(const std::size_t count[256], std::size_t total,
+                      uint16_t freq[256]) {
+  uint32_t sum = 0;
+  for (int s = 0; s < 256; ++s) {
+    freq[s] = count[s] ? uint16_t(std::max<std::size_t>(
+                             1, count[s] * prob_scale / total))
+                       : 0;
+    sum += freq[s];
+  }
+  // the rounding error goes to the most frequent bytes
+  while (sum != prob_scale) {
+    int best = -1;
+    for (int s = 0; s < 256; ++s)
+      if (freq[s] > (sum > prob_scale ? 1 : 0) &&
+          (best < 0 || freq[s] > freq[best]))
+        best = s;
+    if (sum > prob_scale) {
+      --freq[best];
+      --sum;
+    } else {
+      ++freq[best];
+      ++sum;
+    }
+  }
+}
+
+// Appends the frequency table and the rANS code of "raw" to "out". Returns
+// the size of the code, or 0 if it would not be smaller than raw.
+static std::size_t rans_encode(const std::vector<uint8_t> &raw,
+                               std::vector<uint8_t> &out) {
+  std::size_t count[256] = {0};
+  for (uint8_t b : raw) ++count[b];
+  uint16_t freq[256];
+  uint32_t start[256];
+  normalize(count, std::max<std::size_t>(raw.size(), 1), freq);
+  for (uint32_t s = 0, c = 0; s < 256; c += freq[s], ++s) start[s] = c;
+
+  // the coder runs backwards over the data and its output
+  std::vector<uint8_t> code(raw.size() + raw.size() / 2 + 16);
+  uint8_t *ptr = code.data() + code.size();
+  uint32_t x = rans_low;
+  for (std::size_t i = raw.size(); i-- > 0;) {
+    const uint8_t s = raw[i];
+    const uint32_t xmax = ((rans_low >> prob_bits) << 8) * freq[s];
+    while (x >= xmax) {
+      *--ptr = uint8_t(x);
+      x >>= 8;
+    }
+    x = ((x / freq[s]) << prob_bits) + x % freq[s] + start[s];
+  }
+  ptr -= 4;
+  std::memcpy(ptr, &x, 4);
+
+  const std::size_t size = code.data() + code.size() - ptr;
+  if (size + freq_table_bytes >= raw.size()) return 0;
+  const std::size_t offset = out.size();
+  out.resize(offset + freq_table_bytes + size);
+  std::memcpy(&out[offset], freq, freq_table_bytes);
+  std::memcpy(&out[offset + freq_table_bytes], ptr, size);
+  return size;
+}
+
+static void rans_decode(const uint8_t *in, std::size_t size, uint8_t *raw,
+                        std::size_t n) {
+  uint16_t freq[256];
+  uint32_t start[256];
+  uint8_t symbol[prob_scale];
+  std::memcpy(freq, in, freq_table_bytes);
+  uint32_t c = 0;
+  for (int s = 0; s < 256; ++s) {
+    start[s] = c;
+    if (c + freq[s] > prob_scale)
+      throw std::runtime_error("corrupted snapshot chunk");
+    std::memset(symbol + c, s, freq[s]);
+    c += freq[s];
+  }
+  const uint8_t *ptr = in + freq_table_bytes;
+  const uint8_t *end = ptr + size;
+  if (size < 4 || c != prob_scale)
+    throw std::runtime_error("corrupted snapshot chunk");
+  uint32_t x;
+  std::memcpy(&x, ptr, 4);
+  ptr += 4;
+  for (std::size_t i = 0; i < n; ++i) {
+    const uint32_t slot = x & (prob_scale - 1);
+    const uint8_t s = symbol[slot];
+    raw[i] = s;
+    x = freq[s] * (x >> prob_bits) + slot - start[s];
+    while (x < rans_low && ptr < end) x = x << 8 | *ptr++;
+  }
+}
+
+double min_snapshot_error() {
+  return 0.5 / double((1u << morton_bits) - 1);
+}
+
+static int64_t quantize(double v, double lo, double step) {
+  return std::max<int64_t>(0, std::llround((v - lo) / step));
+}
+
+void compress_snapshot(const real_type *const arrays[], int64_t n, bool ids,
+                       double error, int chunk_size,
+                       std::vector<uint8_t> &out) {
+  const int nf = ParticleSoA::nfields;
+  const int mass = nf - 1;
+  CompressedInfo info;
+  std::memset(&info, 0, sizeof(info));
+  info.error = error;
+
+  double hi[nf];
+  for (int a = 0; a < nf; ++a) {
+    if (!arrays[a]) continue;
+    double lo = n ? double(arrays[a][0]) : 0., up = lo;
+    for (int64_t i = 1; i < n; ++i) {
+      lo = std::min(lo, double(arrays[a][i]));
+      up = std::max(up, double(arrays[a][i]));
+    }
+    info.lo[a] = lo;
+    hi[a] = up;
+    const double range = up - lo;
+    info.step[a] = a == mass ? 0. : range > 0. ? 2. * error * range : 1.;
+  }
+
+  // The positions keep the step of their own range and the cells of the
+  // three coordinates are interleaved into a Morton key, with the bits of the
+  // coordinate needing the most levels: at most morton_bits.
+  const bool pos = arrays[0] != nullptr;
+  if (pos) {
+    info.bits = 1;
+    for (int d = 0; d < 3; ++d) {
+      // quantize rounds to the nearest cell, the top one included
+      const double levels =
+          double(std::llround((hi[d] - info.lo[d]) / info.step[d])) + 1.;
+      info.bits = std::max(info.bits, uint32_t(std::ceil(std::log2(levels))));
+    }
+    if (info.bits > morton_bits)
+      throw std::runtime_error(
+          "snapshot error bound too small for the positions");
+  }
+
+  // Morton order of the quantized positions
+  std::vector<uint64_t> keys;
+  std::vector<int> perm(n);
+  for (int64_t i = 0; i < n; ++i) perm[i] = int(i);
+  if (pos) {
+    const uint32_t maxcell = (1u << info.bits) - 1;
+    keys.resize(n);
+#pragma omp parallel for
+    for (int64_t i = 0; i < n; ++i) {
+      uint32_t c[3];
+      for (int d = 0; d < 3; ++d)
+        c[d] = uint32_t(std::min<int64_t>(
+            maxcell,
+            quantize(double(arrays[d][i]), info.lo[d], info.step[d])));
+      keys[i] = morton_key(c[0], c[1], c[2]);
+    }
+    radix_sort(keys, perm, 3 * int(info.bits));
+  }
+
+  info.nchunks = uint32_t((n + chunk_size - 1) / chunk_size);
+  out.resize(sizeof(info));
+  std::memcpy(out.data(), &info, sizeof(info));
+
+  std::vector<uint8_t> raw;
+  for (int64_t b = 0; b < n; b += chunk_size) {
+    const int64_t e = std::min<int64_t>(n, b + chunk_size);
+    raw.clear();
+    // the deltas restart in every chunk
+    if (pos) {
+      uint64_t prev = 0;
+      for (int64_t i = b; i < e; ++i) {
+        put_varint(raw, keys[i] - prev);
+        prev = keys[i];
+      }
+    }
+    for (int a = 3; a < nf; ++a) {
+      if (!arrays[a]) continue;
+      int64_t prev = 0;
+      for (int64_t i = b; i < e; ++i) {
+        const real_type v = arrays[a][perm[i]];
+        int64_t q;
+        if (a == mass) {
+          uint64_t bits = 0;
+          std::memcpy(&bits, &v, sizeof(real_type));
+          q = int64_t(bits);
+        } else {
+          q = quantize(double(v), info.lo[a], info.step[a]);
+        }
+        put_varint(raw, zigzag(int64_t(uint64_t(q) - uint64_t(prev))));
+        prev = q;
+      }
+    }
+    if (ids) {
+      int64_t prev = 0;
+      for (int64_t i = b; i < e; ++i) {
+        put_varint(raw, zigzag(perm[i] - prev));
+        prev = perm[i];
+      }
+    }
+
+    ChunkHeader ch = {uint32_t(e - b), uint32_t(raw.size()), 0, 0};
+    const std::size_t offset = out.size();
+    out.resize(offset + sizeof(ch));
+    ch.packed_size = uint32_t(rans_encode(raw, out));
+    if (!ch.packed_size) out.insert(out.end(), raw.begin(), raw.end());
+    std::memcpy(&out[offset], &ch, sizeof(ch));
+  }
+}
+
+void decompress_chunk(const CompressedInfo &info, const ChunkHeader &ch,
+                      const uint8_t *in, const bool present[],
+                      std::vector<double> arrays[],
+                      std::vector<int64_t> &ids) {
+  const int nf = ParticleSoA::nfields;
+  const int mass = nf - 1;
+  const std::size_t n = ch.count;
+
+  std::vector<uint8_t> buf;
+  const uint8_t *p = in;
+  if (ch.packed_size) {
+    buf.resize(ch.raw_size);
+    rans_decode(in, ch.packed_size, buf.data(), buf.size());
+    p = buf.data();
+  }
+  const uint8_t *end = p + ch.raw_size;
+
+  if (present[0]) {
+    for (int d = 0; d < 3; ++d) arrays[d].resize(n);
+    uint64_t key = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      key += get_varint(p, end);
+      for (int d = 0; d < 3; ++d)
+        arrays[d][i] = info.lo[d] + info.step[d] * compact_bits(key >> d);
+    }
+  }
+  for (int a = 3; a < nf; ++a) {
+    if (!present[a]) continue;
+    arrays[a].resize(n);
+    int64_t q = 0;
+    for (std::size_t i = 0; i < n; ++i) {
+      q = int64_t(uint64_t(q) + uint64_t(unzigzag(get_varint(p, end))));
+      if (a == mass) {
+        real_type v;
+        uint64_t bits = uint64_t(q);
+        std::memcpy(&v, &bits, sizeof(real_type));
+        arrays[a][i] = double(v);
+      } else {
+        arrays[a][i] = info.lo[a] + info.step[a] * double(q);
+      }
+    }
+  }
+  if (present[nf]) {
+    ids.resize(n);
+    int64_t id = 0;
+    for (std::size_t i = 0; i < n; ++i)
+      ids[i] = id += unzigzag(get_varint(p, end));
+  }
+}
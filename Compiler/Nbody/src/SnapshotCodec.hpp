@@ -0,0 +1,72 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#ifndef _SNAPSHOTCODEC_HPP
+#define _SNAPSHOTCODEC_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ParticleSoA.hpp"
+
+// Lossy compression of the particle arrays of a snapshot.
+//
+// Every array is quantized on a uniform grid over its range, with a step of
+// twice the error bound times that range, so that no value moves by more than
+// "error" times the range of its array. The cell indices of the three
+// position coordinates are interleaved into a Morton key of at most
+// morton_bits bits per coordinate, which sets the smallest error bound; the
+// particles are sorted by key and stored in that order. Within a chunk the
+// keys are delta encoded, the other arrays store the difference to the
+// previous particle (spatial neighbours have similar velocities), and masses
+// keep their exact bits. The deltas are written as zigzag varints and
+// compressed with an order-0 rANS coder. Every chunk is decoded on its own,
+// so a snapshot can be read chunk by chunk.
+
+// Follows the SnapshotHeader of a compressed snapshot
+struct CompressedInfo {
+  double lo[ParticleSoA::nfields];    // lower bound of each array
+  double step[ParticleSoA::nfields];  // quantization step, 0 if exact
+  double error;                       // error bound relative to the ranges
+  uint32_t bits;                      // bits per position coordinate
+  uint32_t nchunks;                   // number of chunks
+};
+
+// Precedes the data of every chunk. If packed_size is 0 the raw_size bytes
+// of varints follow as they are, otherwise a table of 256 uint16 symbol
+// frequencies and packed_size bytes of rANS code.
+struct ChunkHeader {
+  uint32_t count;        // particles in the chunk
+  uint32_t raw_size;     // bytes of varints
+  uint32_t packed_size;  // bytes of entropy coded data
+  uint32_t reserved;
+};
+
+// smallest error bound the Morton keys of the positions can meet
+double min_snapshot_error();
+
+// Compresses the "nfields" arrays (nullptr for the fields that are not
+// written) of n particles into "out": a CompressedInfo followed by the
+// chunks. If ids is set, the original index of every particle is stored as an
+// additional array after the mass. Throws std::runtime_error if the positions
+// are written with an error below min_snapshot_error().
+void compress_snapshot(const real_type *const arrays[], int64_t n, bool ids,
+                       double error, int chunk_size, std::vector<uint8_t> &out);
+
+// Decodes the chunk at "in" holding "size" bytes after its ChunkHeader.
+// "arrays" receives count values for every array present (with ids last).
+void decompress_chunk(const CompressedInfo &info, const ChunkHeader &ch,
+                      const uint8_t *in, const bool present[],
+                      std::vector<double> arrays[], std::vector<int64_t> &ids);
+
+// bytes following the ChunkHeader
+inline std::size_t chunk_payload(const ChunkHeader &ch) {
+  return ch.packed_size ? 256 * sizeof(uint16_t) + std::size_t(ch.packed_size)
+                        : ch.raw_size;
+}
+
+#endif
@@ -0,0 +1,164 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+#include "SpatialSort.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+void curve_keys(const real_type* x, const real_type* y, const real_type* z,
+                int n, bool hilbert, std::vector<uint64_t>& keys) {
+  double xmin = n ? x[0] : 0., xmax = xmin, ymin = n ? y[0] : 0., ymax = ymin;
+  double zmin = n ? z[0] : 0., zmax = zmin;
+#pragma omp parallel for reduction(min : xmin, ymin, zmin) \
+    reduction(max : xmax, ymax, zmax)
+  for (int i = 0; i < n; ++i) {
+    xmin = std::min(xmin, double(x[i]));
+    xmax = std::max(xmax, double(x[i]));
+    ymin = std::min(ymin, double(y[i]));
+    ymax = std::max(ymax, double(y[i]));
+    zmin = std::min(zmin, double(z[i]));
+    zmax = std::max(zmax, double(z[i]));
+  }
+  double ext = std::max({xmax - xmin, ymax - ymin, zmax - zmin});
+  ext = ext > 0 ? ext * 1.001 : 1.;
+  const double scale = double(1 << morton_bits) / ext;
+  const uint32_t maxcell = (1u << morton_bits) - 1;
+
+  keys.resize(n);
+#pragma omp parallel for
+  for (int i = 0; i < n; ++i) {
+    uint32_t ix = std::min(maxcell, uint32_t((x[i] - xmin) * scale));
+    uint32_t iy = std::min(maxcell, uint32_t((y[i] - ymin) * scale));
+    uint32_t iz = std::min(maxcell, uint32_t((z[i] - zmin) * scale));
+    keys[i] = hilbert ? hilbert_key(ix, iy, iz) : morton_key(ix, iy, iz);
+  }
+}
+
+void radix_sort(std::vector<uint64_t>& keys, std::vector<int>& perm,
+                int keybits) {
+  const int radix = 256;
+  const std::size_t n = keys.size();
+#ifdef _OPENMP
+  const int maxthreads = omp_get_max_threads();
+#else
+  const int maxthreads = 1;
+#endif
+  std::vector<uint64_t> ktmp(n);
+  std::vector<int> ptmp(n);
+  std::vector<std::size_t> hist(maxthreads * radix);
+
+  for (int shift = 0; shift < keybits; shift += 8) {
+    bool skip = false;
+#pragma omp parallel
+    {
+#ifdef _OPENMP
+      const int nt = omp_get_num_threads();
+      const int t = omp_get_thread_num();
+#else
+      const int nt = 1;
+      const int t = 0;
+#endif
+      // every thread owns a contiguous chunk, which keeps the sort stable
+      const std::size_t begin = n * t / nt;
+      const std::size_t end = n * (t + 1) / nt;
+      std::size_t* h = &hist[t * radix];
+      for (int d = 0; d < radix; ++d) h[d] = 0;
+      for (std::size_t i = begin; i < end; ++i) h[(keys[i] >> shift) & 0xff]++;
+#pragma omp barrier
+#pragma omp single
+      {
+        std::size_t offset = 0;
+        for (int d = 0; d < radix; ++d) {
+          std::size_t total = 0;
+          for (int s = 0; s < nt; ++s) {
+            std::size_t c = hist[s * radix + d];
+            hist[s * radix + d] = offset;
+            offset += c;
+            total += c;
+          }
+          // all keys share this digit: nothing to reorder
+          if (total == n) skip = true;
+        }
+      }
+      if (!skip) {
+        for (std::size_t i = begin; i < end; ++i) {
+          std::size_t pos = h[(keys[i] >> shift) & 0xff]++;
+          ktmp[pos] = keys[i];
+          ptmp[pos] = perm[i];
+        }
+      }
+    }
+    if (!skip) {
+      keys.swap(ktmp);
+      perm.swap(ptmp);
+    }
+  }
+}
+
+void counting_sort(const std::vector<int>& cell, int ncell,
+                   std::vector<int>& perm, std::vector<int>& start) {
+  const std::size_t n = cell.size();
+#ifdef _OPENMP
+  const int maxthreads = omp_get_max_threads();
+#else
+  const int maxthreads = 1;
+#endif
+  std::vector<int> hist(std::size_t(maxthreads) * ncell);
+  std::vector<int> totals(maxthreads + 1);
+  perm.resize(n);
+  start.resize(ncell + 1);
+
+#pragma omp parallel
+  {
+#ifdef _OPENMP
+    const int nt = omp_get_num_threads();
+    const int t = omp_get_thread_num();
+#else
+    const int nt = 1;
+    const int t = 0;
+#endif
+    // every thread counts and scatters a contiguous chunk, which keeps the
+    // sort stable
+    const std::size_t begin = n * t / nt;
+    const std::size_t end = n * (t + 1) / nt;
+    int* h = &hist[std::size_t(t) * ncell];
+    for (int c = 0; c < ncell; ++c) h[c] = 0;
+    for (std::size_t i = begin; i < end; ++i) h[cell[i]]++;
+#pragma omp barrier
+    // every thread scans the counts of its own range of cells, which is then
+    // shifted by the totals of the ranges before it
+    const int cbegin = int(std::size_t(ncell) * t / nt);
+    const int cend = int(std::size_t(ncell) * (t + 1) / nt);
+    int offset = 0;
+    for (int c = cbegin; c < cend; ++c) {
+      start[c] = offset;
+      for (int s = 0; s < nt; ++s) offset += hist[std::size_t(s) * ncell + c];
+    }
+    totals[t + 1] = offset;
+#pragma omp barrier
+#pragma omp single
+    {
+      for (int s = 0; s < nt; ++s) totals[s + 1] += totals[s];
+      start[ncell] = totals[nt];
+    }
+    for (int c = cbegin; c < cend; ++c) {
+      start[c] += totals[t];
+      int pos = start[c];
+      for (int s = 0; s < nt; ++s) {
+        int& hc = hist[std::size_t(s) * ncell + c];
+        const int count = hc;
+        hc = pos;
+        pos += count;
+      }
+    }
+#pragma omp barrier
+    for (std::size_t i = begin; i < end; ++i) perm[h[cell[i]]++] = int(i);
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef _SPATIALSORT_HPP
+#define _SPATIALSORT_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "type.hpp"
+
+// number of bits per dimension of a 63-bit Morton key
+const int morton_bits = 21;
+
+// Spreads the lower 21 bits of v, so that two zero bits separate them
+inline uint64_t spread_bits(uint64_t v) {
+  v &= 0x1fffff;
+  v = (v | v << 32) & 0x1f00000000ffffull;
+  v = (v | v << 16) & 0x1f0000ff0000ffull;
+  v = (v | v << 8) & 0x100f00f00f00f00full;
+  v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+  v = (v | v << 2) & 0x1249249249249249ull;
+  return v;
+}
+
+// Inverse of spread_bits: gathers every third bit of v
+inline uint32_t compact_bits(uint64_t v) {
+  v &= 0x1249249249249249ull;
+  v = (v | v >> 2) & 0x10c30c30c30c30c3ull;
+  v = (v | v >> 4) & 0x100f00f00f00f00full;
+  v = (v | v >> 8) & 0x1f0000ff0000ffull;
+  v = (v | v >> 16) & 0x1f00000000ffffull;
+  v = (v | v >> 32) & 0x1fffff;
+  return uint32_t(v);
+}
+
+// Interleaves the bits of the cell coordinates: bit 3k is bit k of ix, bit
+// 3k+1 of iy and bit 3k+2 of iz
+inline uint64_t morton_key(uint32_t ix, uint32_t iy, uint32_t iz) {
+  return spread_bits(ix) | spread_bits(iy) << 1 | spread_bits(iz) << 2;
+}
+
+// Index of the cell along the Hilbert curve through the cube of 2^21 cells
+// per side, with Skilling's transform of the coordinates into the transposed
+// index, whose bits are then interleaved like a Morton key
+inline uint64_t hilbert_key(uint32_t ix, uint32_t iy, uint32_t iz) {
+  uint32_t X[3] = {ix, iy, iz};
+  const uint32_t M = 1u << (morton_bits - 1);
+  for (uint32_t Q = M; Q > 1; Q >>= 1) {
+    const uint32_t P = Q - 1;
+    for (int i = 0; i < 3; ++i) {
+      if (X[i] & Q) {
+        X[0] ^= P;
+      } else {
+        const uint32_t t = (X[0] ^ X[i]) & P;
+        X[0] ^= t;
+        X[i] ^= t;
+      }
+    }
+  }
+  X[1] ^= X[0];
+  X[2] ^= X[1];
+  uint32_t t = 0;
+  for (uint32_t Q = M; Q > 1; Q >>= 1)
+    if (X[2] & Q) t ^= Q - 1;
+  for (int i = 0; i < 3; ++i) X[i] ^= t;
+  return spread_bits(X[2]) | spread_bits(X[1]) << 1 | spread_bits(X[0]) << 2;
+}
+
+// Keys of the points along the Morton or the Hilbert curve through the cells
+// of 2^21 per side of their bounding cube
+void curve_keys(const real_type *x, const real_type *y, const real_type *z,
+                int n, bool hilbert, std::vector<uint64_t> &keys);
+
+// Sorts keys in ascending order and applies the same permutation to perm.
+// Parallel, stable LSD radix sort over the lowest "keybits" bits.
+void radix_sort(std::vector<uint64_t> &keys, std::vector<int> &perm,
+                int keybits = 3 * morton_bits);
+
+// Parallel, stable counting sort of the indices 0 .. n-1 by their cell in
+// [0, ncell). perm receives the sorted indices and start[c] the position of
+// the first index of cell c, with start[ncell] = n.
+void counting_sort(const std::vector<int> &cell, int ncell,
+                   std::vector<int> &perm, std::vector<int> &start);
+
+#endif
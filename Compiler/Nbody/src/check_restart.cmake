@@ -0,0 +1,28 @@
+# Restart equivalence: for every integrator, runs NBODY for 6 steps at once,
+# then for 3 steps and restarted from the checkpoint of step 3 up to step 6,
+# and fails unless both final checkpoints are identical. The Hermite scheme
+# is left out: the checkpoints hold no jerks, which are recomputed on restart
+# and only agree to rounding.
+#   cmake -DNBODY=path/to/nbody -P check_restart.cmake
+if(NOT NBODY)
+	message(FATAL_ERROR "usage: cmake -DNBODY=path/to/nbody -P check_restart.cmake")
+endif()
+foreach(integrator euler leapfrog yoshida4)
+	set(args --layout=soa --integrator=${integrator})
+	execute_process(COMMAND ${NBODY} 1000 6 ${args} --checkpoint=straight.ck
+		RESULT_VARIABLE r1 OUTPUT_QUIET)
+	execute_process(COMMAND ${NBODY} 1000 3 ${args} --checkpoint=half.ck
+		RESULT_VARIABLE r2 OUTPUT_QUIET)
+	execute_process(COMMAND ${NBODY} 1000 6 ${args} --restart=half.ck
+		--checkpoint=restarted.ck RESULT_VARIABLE r3 OUTPUT_QUIET)
+	if(r1 OR r2 OR r3)
+		message(FATAL_ERROR "${integrator}: nbody failed")
+	endif()
+	execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files straight.ck
+		restarted.ck RESULT_VARIABLE differ)
+	file(REMOVE straight.ck half.ck restarted.ck)
+	if(differ)
+		message(FATAL_ERROR "${integrator}: the restarted run differs")
+	endif()
+	message(STATUS "${integrator}: restart matches")
+endforeach()
@@ -0,0 +1,27 @@
+# Compressed snapshots: runs CHECK, the round trip of the codec and of the
+# snapshot files, then runs NBODY twice with the same particles, writing its
+# snapshots as they are and compressed, and has CHECK read both back chunk by
+# chunk and compare them to the error bound.
+#   cmake -DNBODY=path/to/nbody -DCHECK=path/to/snapshot_check -P check_snapshot.cmake
+if(NOT NBODY OR NOT CHECK)
+	message(FATAL_ERROR "usage: cmake -DNBODY=path/to/nbody -DCHECK=path/to/snapshot_check -P check_snapshot.cmake")
+endif()
+execute_process(COMMAND ${CHECK} RESULT_VARIABLE r)
+if(r)
+	message(FATAL_ERROR "the snapshot round trip failed")
+endif()
+set(error 0.032)
+set(args 1000 5 --layout=soa --fields=pos,vel,acc,mass,id)
+execute_process(COMMAND ${NBODY} ${args} --snapshot=exact.snp
+	RESULT_VARIABLE r1 OUTPUT_QUIET)
+execute_process(COMMAND ${NBODY} ${args} --snapshot=packed.snp
+	--snapshot-error=${error} RESULT_VARIABLE r2 OUTPUT_QUIET)
+if(r1 OR r2)
+	message(FATAL_ERROR "nbody failed")
+endif()
+execute_process(COMMAND ${CHECK} exact.snp packed.snp ${error}
+	RESULT_VARIABLE r3)
+file(REMOVE exact.snp packed.snp)
+if(r3)
+	message(FATAL_ERROR "the compressed snapshots of nbody differ")
+endif()
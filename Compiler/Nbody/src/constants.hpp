@@ -0,0 +1,9 @@
+#ifndef _CONSTANTS_HPP
+#define _CONSTANTS_HPP
+
+// prevents explosion in the case the particles are really close to each other
+const float softeningSquared = 1e-3f;
+// gravitational constant
+const float G = 6.67259e-11f;
+
+#endif
@@ -17,11 +17,39 @@ COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
 IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
 CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
 
 #include "GSimulation.hpp"
+#ifdef NBODY_MPI
+#include <mpi.h>
+
+// Keeps MPI initialized for the lifetime of main, only rank 0 prints
+struct MPISession {
+  MPISession(int *argc, char ***argv) {
+    MPI_Init(argc, argv);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (rank) std::cout.rdbuf(nullptr);
+  }
+  ~MPISession() { MPI_Finalize(); }
+};
+#endif
+
+// Returns the value of "--name=value" if arg is that option, nullptr otherwise
+static const char *option_value(const char *arg, const char *name) {
+  size_t len = std::strlen(name);
+  if (std::strncmp(arg, "--", 2) || std::strncmp(arg + 2, name, len) ||
+      arg[len + 2] != '=')
+    return nullptr;
+  return arg + len + 3;
+}
 
 int main(int argc, char** argv) {
+#ifdef NBODY_MPI
+  MPISession mpi(&argc, &argv);
+#endif
   char *env = std::getenv( "SYCL_BE" );
   std::cout << "[ENV] SYCL_BE = " << (env ? env : "<not set>") << "\n";
 
@@ -29,17 +57,213 @@ int main(int argc, char** argv) {
   int nstep;  // number ot integration steps
 
   GSimulation sim;
+  const char *convert = nullptr;     // "in.csv,out" to convert
+  const char *checkpoint = nullptr;  // checkpoint file
+  int ckfreq = 0;                    // steps between two checkpoints
+  const char *snapshot = nullptr;    // snapshot file
+  int snapfreq = 1;                  // steps between two snapshots
+  unsigned fields = SnapshotWriter::Position | SnapshotWriter::Velocity |
+                    SnapshotWriter::Mass;
+  int sortfreq = 0;                  // steps between two re-sorts
+  Curve curve = Curve::Morton;       // curve of the re-sorts
 
-  if (argc > 1) {
-    N = atoi(argv[1]);
-    sim.set_number_of_particles(N);
-    if (argc == 3) {
-      nstep = atoi(argv[2]);
-      sim.set_number_of_steps(nstep);
+  // options are given as --name=value and may follow the positional arguments
+  int npos = 0;
+  for (int i = 1; i < argc; ++i) {
+    const char *arg = argv[i];
+    const char *val;
+    if (std::strncmp(arg, "--", 2) != 0) {
+      if (npos == 0) {
+        N = atoi(arg);
+        sim.set_number_of_particles(N);
+      } else if (npos == 1) {
+        nstep = atoi(arg);
+        sim.set_number_of_steps(nstep);
+      }
+      npos++;
+    } else if ((val = option_value(arg, "layout")) && !std::strcmp(val, "aos")) {
+      sim.set_layout(Layout::AoS);
+    } else if ((val = option_value(arg, "layout")) && !std::strcmp(val, "soa")) {
+      sim.set_layout(Layout::SoA);
+    } else if ((val = option_value(arg, "integrator")) &&
+               !std::strcmp(val, "euler")) {
+      sim.set_integrator(Integrator::Euler);
+    } else if ((val = option_value(arg, "integrator")) &&
+               !std::strcmp(val, "leapfrog")) {
+      sim.set_integrator(Integrator::Leapfrog);
+    } else if ((val = option_value(arg, "integrator")) &&
+               !std::strcmp(val, "yoshida4")) {
+      sim.set_integrator(Integrator::Yoshida4);
+    } else if ((val = option_value(arg, "integrator")) &&
+               !std::strcmp(val, "hermite4")) {
+      sim.set_integrator(Integrator::Hermite4);
+    } else if ((val = option_value(arg, "levels"))) {
+      sim.set_block_levels(atoi(val));
+    } else if ((val = option_value(arg, "eta"))) {
+      sim.set_eta(atof(val));
+    } else if ((val = option_value(arg, "checkpoint"))) {
+      checkpoint = val;
+    } else if ((val = option_value(arg, "checkpoint-every"))) {
+      ckfreq = atoi(val);
+    } else if ((val = option_value(arg, "snapshot"))) {
+      snapshot = val;
+    } else if ((val = option_value(arg, "snapshot-every"))) {
+      snapfreq = atoi(val);
+    } else if ((val = option_value(arg, "snapshot-error"))) {
+      sim.set_snapshot_error(atof(val));
+    } else if ((val = option_value(arg, "fields"))) {
+      fields = SnapshotWriter::parse_fields(val);
+      if (!fields) {
+        std::cout << "Unknown field in " << val << "\n";
+        return 1;
+      }
+    } else if ((val = option_value(arg, "model")) && !std::strcmp(val, "cube")) {
+      sim.set_model(Model::Cube);
+    } else if ((val = option_value(arg, "model")) &&
+               !std::strcmp(val, "plummer")) {
+      sim.set_model(Model::Plummer);
+    } else if ((val = option_value(arg, "model")) &&
+               !std::strcmp(val, "hernquist")) {
+      sim.set_model(Model::Hernquist);
+    } else if ((val = option_value(arg, "model")) && !std::strcmp(val, "disk")) {
+      sim.set_model(Model::Disk);
+    } else if ((val = option_value(arg, "seed"))) {
+      sim.set_seed(strtoull(val, nullptr, 10));
+    } else if ((val = option_value(arg, "restart"))) {
+      sim.set_restart(val);
+    } else if ((val = option_value(arg, "ic"))) {
+      sim.set_initial_conditions(val);
+    } else if ((val = option_value(arg, "convert-ic"))) {
+      convert = val;
+    } else if (!std::strcmp(arg, "--pipelined")) {
+      sim.set_pipelined(true);
+    } else if ((val = option_value(arg, "solver")) &&
+               !std::strcmp(val, "direct")) {
+      sim.set_solver(Solver::Direct);
+    } else if ((val = option_value(arg, "solver")) && !std::strcmp(val, "bh")) {
+      sim.set_solver(Solver::BarnesHut);
+    } else if ((val = option_value(arg, "solver")) && !std::strcmp(val, "fmm")) {
+      sim.set_solver(Solver::FMM);
+    } else if ((val = option_value(arg, "solver")) && !std::strcmp(val, "pm")) {
+      sim.set_solver(Solver::PM);
+    } else if ((val = option_value(arg, "solver")) &&
+               !std::strcmp(val, "cutoff")) {
+      sim.set_solver(Solver::Cutoff);
+    } else if ((val = option_value(arg, "cutoff")) && atof(val) > 0) {
+      sim.set_cutoff(atof(val));
+    } else if ((val = option_value(arg, "grid")) && atoi(val) > 0) {
+      sim.set_pm_grid(atoi(val));
+    } else if ((val = option_value(arg, "box")) && atof(val) > 0) {
+      sim.set_pm_box(atof(val));
+    } else if ((val = option_value(arg, "order")) && atoi(val) > 0) {
+      sim.set_fmm_order(atoi(val));
+    } else if ((val = option_value(arg, "theta")) && atof(val) >= 0) {
+      sim.set_theta(atof(val));
+    } else if ((val = option_value(arg, "leaf")) && atoi(val) > 0) {
+      sim.set_leaf_size(atoi(val));
+    } else if ((val = option_value(arg, "kernel")) && !std::strcmp(val, "flat")) {
+      sim.set_force_kernel(ForceKernel::Flat);
+    } else if ((val = option_value(arg, "kernel")) &&
+               !std::strcmp(val, "tiled")) {
+      sim.set_force_kernel(ForceKernel::Tiled);
+    } else if ((val = option_value(arg, "kernel")) &&
+               !std::strcmp(val, "symmetric")) {
+      sim.set_force_kernel(ForceKernel::Symmetric);
+    } else if ((val = option_value(arg, "kernel")) &&
+               !std::strcmp(val, "specialized")) {
+      sim.set_force_kernel(ForceKernel::Specialized);
+    } else if ((val = option_value(arg, "kernel")) &&
+               !std::strcmp(val, "blocked")) {
+      sim.set_force_kernel(ForceKernel::Blocked);
+    } else if ((val = option_value(arg, "iblock")) &&
+               (atoi(val) == 2 || atoi(val) == 4 || atoi(val) == 8)) {
+      sim.set_iblock(atoi(val));
+    } else if ((val = option_value(arg, "softening")) &&
+               !std::strcmp(val, "plummer")) {
+      sim.set_softening(Softening::Plummer);
+    } else if ((val = option_value(arg, "softening")) &&
+               !std::strcmp(val, "spline")) {
+      sim.set_softening(Softening::Spline);
+    } else if ((val = option_value(arg, "rsqrt")) &&
+               !std::strcmp(val, "exact")) {
+      sim.set_rsqrt(Rsqrt::Exact);
+    } else if ((val = option_value(arg, "rsqrt")) &&
+               !std::strcmp(val, "native")) {
+      sim.set_rsqrt(Rsqrt::Native);
+    } else if ((val = option_value(arg, "rsqrt")) &&
+               !std::strcmp(val, "newton")) {
+      sim.set_rsqrt(Rsqrt::Newton);
+    } else if ((val = option_value(arg, "kernel-precision")) &&
+               !std::strcmp(val, "float")) {
+      sim.set_kernel_precision(KernelPrecision::Float);
+    } else if ((val = option_value(arg, "kernel-precision")) &&
+               !std::strcmp(val, "double")) {
+      sim.set_kernel_precision(KernelPrecision::Double);
+    } else if ((val = option_value(arg, "memory")) &&
+               !std::strcmp(val, "buffer")) {
+      sim.set_memory(Memory::Buffer);
+    } else if ((val = option_value(arg, "memory")) &&
+               !std::strcmp(val, "device")) {
+      sim.set_memory(Memory::Device);
+    } else if ((val = option_value(arg, "memory")) &&
+               !std::strcmp(val, "shared")) {
+      sim.set_memory(Memory::Shared);
+    } else if ((val = option_value(arg, "memory")) &&
+               !std::strcmp(val, "host")) {
+      sim.set_memory(Memory::Host);
+    } else if ((val = option_value(arg, "split")) &&
+               !std::strcmp(val, "none")) {
+      sim.set_split(Split::None);
+    } else if ((val = option_value(arg, "split")) &&
+               !std::strcmp(val, "numa")) {
+      sim.set_split(Split::Numa);
+    } else if ((val = option_value(arg, "split")) &&
+               !std::strcmp(val, "devices")) {
+      sim.set_split(Split::Devices);
+    } else if ((val = option_value(arg, "sort-every"))) {
+      sortfreq = atoi(val);
+    } else if ((val = option_value(arg, "curve")) &&
+               !std::strcmp(val, "morton")) {
+      curve = Curve::Morton;
+    } else if ((val = option_value(arg, "curve")) &&
+               !std::strcmp(val, "hilbert")) {
+      curve = Curve::Hilbert;
+    } else if ((val = option_value(arg, "ensemble")) && atoi(val) > 0) {
+      sim.set_ensemble(atoi(val));
+    } else if ((val = option_value(arg, "report"))) {
+      sim.set_report(val);
+    } else if ((val = option_value(arg, "wg")) && atoi(val) > 0) {
+      sim.set_work_group_size(atoi(val));
+    } else if ((val = option_value(arg, "tile")) && atoi(val) > 0) {
+      sim.set_tile_size(atoi(val));
+    } else {
+      std::cout << "Unknown option " << arg << "\n";
+      return 1;
     }
   }
 
-  sim.start();
+  if (checkpoint) sim.set_checkpoint(checkpoint, ckfreq);
+  if (sortfreq > 0) sim.set_sort(sortfreq, curve);
+  if (snapshot) sim.set_snapshot(snapshot, snapfreq > 0 ? snapfreq : 1, fields);
+
+  try {
+    if (convert) {
+      // converts the initial conditions and exits
+      const char *comma = std::strchr(convert, ',');
+      if (!comma) {
+        std::cout << "Usage: --convert-ic=in.csv,out\n";
+        return 1;
+      }
+      std::string csv(convert, comma - convert);
+      int64_t n = Checkpoint::convert_csv(csv, comma + 1);
+      std::cout << "Converted " << n << " particles to " << comma + 1 << "\n";
+      return 0;
+    }
+    sim.start();
+  } catch (const std::runtime_error &e) {
+    std::cout << "Error: " << e.what() << "\n";
+    return 1;
+  }
 
   return 0;
 }
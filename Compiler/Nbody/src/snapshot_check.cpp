@@ -0,0 +1,210 @@
+//==============================================================
+// Copyright © 2020 Intel Corporation
+//
+// SPDX-License-Identifier: MIT
+// =============================================================
+
+// Checks the compressed snapshots. Without arguments it compresses random
+// particles at a few error bounds whose cell counts do not divide the ranges
+// and decodes them chunk by chunk, then writes random snapshots with
+// SnapshotWriter, compressed and not, and reads them back with
+// SnapshotReader. With arguments it compares the snapshots of two files
+// written by the same run, the second with --snapshot-error=E and the id
+// field.
+//   ./snapshot_check
+//   ./snapshot_check exact.snp compressed.snp E
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Snapshot.hpp"
+#include "SnapshotCodec.hpp"
+
+// largest error of the decoded arrays relative to "error" times their range
+static double round_trip(const std::vector<real_type> v[], int64_t n,
+                         double error) {
+  const int nf = ParticleSoA::nfields;
+  const real_type *arrays[nf];
+  double lo[nf], range[nf];
+  for (int a = 0; a < nf; ++a) {
+    arrays[a] = v[a].data();
+    auto mm = std::minmax_element(v[a].begin(), v[a].end());
+    lo[a] = double(*mm.first);
+    range[a] = double(*mm.second) - lo[a];
+  }
+  std::vector<uint8_t> out;
+  compress_snapshot(arrays, n, true, error, 1000, out);
+
+  CompressedInfo info;
+  std::memcpy(&info, out.data(), sizeof(info));
+  bool present[nf + 1];
+  std::fill(present, present + nf + 1, true);
+  const uint8_t *p = out.data() + sizeof(info);
+  double worst = 0.;
+  int64_t decoded = 0;
+  for (uint32_t c = 0; c < info.nchunks; ++c) {
+    ChunkHeader ch;
+    std::memcpy(&ch, p, sizeof(ch));
+    p += sizeof(ch);
+    std::vector<double> d[nf];
+    std::vector<int64_t> ids;
+    decompress_chunk(info, ch, p, present, d, ids);
+    p += chunk_payload(ch);
+    for (uint32_t i = 0; i < ch.count; ++i)
+      for (int a = 0; a < nf; ++a) {
+        const double e = std::fabs(d[a][i] - double(v[a][ids[i]]));
+        if (a == nf - 1 && e > 0.)
+          throw std::runtime_error("the masses are not exact");
+        if (range[a] > 0.) worst = std::max(worst, e / (error * range[a]));
+      }
+    decoded += ch.count;
+  }
+  if (decoded != n) throw std::runtime_error("particles lost in the chunks");
+  return worst;
+}
+
+// Reads the snapshots of "exact" and "packed", written without and with
+// compression, and checks that they hold the same particles to the error
+// bound. Of three consecutive snapshots the first is decoded in full, the
+// second only by its first chunk and the third is skipped in both files.
+static void compare_files(const std::string &exact, const std::string &packed,
+                          double error) {
+  const int nf = ParticleSoA::nfields;
+  SnapshotReader re, rp;
+  re.open(exact);
+  rp.open(packed);
+  std::vector<double> e[nf], p[nf], full[nf];
+  std::vector<int64_t> ids;
+  int k = 0;
+  for (; re.next_snapshot(); ++k) {
+    if (!rp.next_snapshot())
+      throw std::runtime_error(packed + " has fewer snapshots");
+    const SnapshotHeader &he = re.header();
+    const SnapshotHeader &hp = rp.header();
+    if (re.compressed() || !rp.compressed())
+      throw std::runtime_error(
+          "expected an uncompressed and a compressed file");
+    if (hp.step != he.step || hp.npart != he.npart)
+      throw std::runtime_error("the snapshots of the files differ");
+    if (k % 3 == 2) continue;
+
+    // the uncompressed snapshot, indexed by particle, and its ranges
+    const int64_t n = he.npart;
+    for (int a = 0; a < nf; ++a) full[a].assign(n, 0.);
+    while (int count = re.next_chunk(e, ids))
+      for (int a = 0; a < nf; ++a)
+        if (!e[a].empty())
+          for (int i = 0; i < count; ++i) full[a][ids[i]] = e[a][i];
+    double range[nf];
+    for (int a = 0; a < nf; ++a) {
+      auto mm = std::minmax_element(full[a].begin(), full[a].end());
+      range[a] = n ? *mm.second - *mm.first : 0.;
+    }
+
+    int64_t decoded = 0;
+    while (int count = rp.next_chunk(p, ids)) {
+      if (ids.empty())
+        throw std::runtime_error(packed + " does not store the id field");
+      for (int a = 0; a < nf; ++a) {
+        if (p[a].empty()) continue;
+        for (int i = 0; i < count; ++i) {
+          const double d = std::fabs(p[a][i] - full[a][ids[i]]);
+          if (d > error * range[a] * (1. + 1e-6) + 1e-30)
+            throw std::runtime_error(
+                "snapshot " + std::to_string(k) + ": array " +
+                std::to_string(a) + " exceeds the error bound");
+        }
+      }
+      decoded += count;
+      if (k % 3 == 1) break;
+    }
+    if (k % 3 == 0 && decoded != n)
+      throw std::runtime_error("particles lost in the chunks");
+  }
+  if (rp.next_snapshot())
+    throw std::runtime_error(packed + " has more snapshots");
+  std::cout << k << " snapshots of " << packed << " match " << exact
+            << std::endl;
+}
+
+// random particles, with ranges of very different sizes and the positions as
+// flat as a disk
+static void random_particles(std::mt19937 &gen, std::vector<real_type> v[],
+                             int64_t n) {
+  const int nf = ParticleSoA::nfields;
+  const double scale[nf] = {6., 0.6, 30., 1., 2., 3., 0.1, 0.1, 0.1, 1.};
+  std::uniform_real_distribution<double> u(-0.5, 0.5);
+  for (int a = 0; a < nf; ++a) {
+    v[a].resize(n);
+    for (auto &x : v[a]) x = real_type(scale[a] * u(gen));
+  }
+  for (auto &m : v[nf - 1]) m = real_type(std::fabs(double(m)) + 1.);
+}
+
+// writes a few snapshots of random particles in chunks of 1000, compressed
+// and not, and compares them
+static void write_and_read(std::mt19937 &gen, double error) {
+  const int nf = ParticleSoA::nfields;
+  const int n = 4500;
+  const std::string exact = "snapshot_check.snp";
+  const std::string packed = "snapshot_check_packed.snp";
+  ParticleSoA ps;
+  ps.resize(n);
+  real_type *arrays[nf] = {ps.pos_x, ps.pos_y, ps.pos_z, ps.vel_x, ps.vel_y,
+                           ps.vel_z, ps.acc_x, ps.acc_y, ps.acc_z, ps.mass};
+  SnapshotWriter we, wp;
+  const unsigned fields = SnapshotWriter::AllFields | SnapshotWriter::Index;
+  we.open(exact, fields, 0., 1000);
+  wp.open(packed, fields, error, 1000);
+  std::vector<real_type> v[nf];
+  for (int s = 0; s < 7; ++s) {
+    random_particles(gen, v, n);
+    for (int a = 0; a < nf; ++a)
+      std::copy(v[a].begin(), v[a].end(), arrays[a]);
+    we.submit(ps, s, 0.1 * s);
+    wp.submit(ps, s, 0.1 * s);
+  }
+  we.close();
+  wp.close();
+  compare_files(exact, packed, error);
+  std::remove(exact.c_str());
+  std::remove(packed.c_str());
+}
+
+int main(int argc, char **argv) {
+  try {
+    if (argc == 4) {
+      compare_files(argv[1], argv[2], std::atof(argv[3]));
+      return 0;
+    }
+    const int nf = ParticleSoA::nfields;
+    const int64_t n = 5000;
+    std::mt19937 gen(42);
+    std::vector<real_type> v[nf];
+    random_particles(gen, v, n);
+
+    bool ok = true;
+    for (double error : {0.12, 0.06, 0.032, 0.03, 0.0333, 0.01, 1e-3, 1e-5,
+                         3e-7}) {
+      const double worst = round_trip(v, n, error);
+      std::cout << "error " << error << ": largest error " << worst
+                << " of the bound" << std::endl;
+      // the decoded values are doubles, the bound holds to rounding
+      if (worst > 1. + 1e-6) ok = false;
+    }
+    if (!ok) throw std::runtime_error("error bound exceeded");
+    write_and_read(gen, 0.032);
+  } catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -1 +1,29 @@
+#ifndef _TYPE_HPP
+#define _TYPE_HPP
+
+// Precision of the simulation, selected at compile time:
+// - real_type stores the particle data: float by default, sycl::half with
+//   NBODY_STORAGE_HALF or double with NBODY_STORAGE_DOUBLE;
+// - compute_type is used for the arithmetic of the kernels, never less than
+//   float;
+// - accum_type sums the forces and the kinetic energy: double with
+//   NBODY_ACCUM_DOUBLE, compute_type otherwise.
+#if defined(NBODY_STORAGE_HALF)
+#include <CL/sycl.hpp>
+typedef sycl::half real_type;
+typedef float compute_type;
+#elif defined(NBODY_STORAGE_DOUBLE)
+typedef double real_type;
+typedef double compute_type;
+#else
 typedef float real_type;
+typedef float compute_type;
+#endif
+
+#if defined(NBODY_ACCUM_DOUBLE)
+typedef double accum_type;
+#else
+typedef compute_type accum_type;
+#endif
+
+#endif